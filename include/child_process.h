@@ -0,0 +1,13 @@
+#ifndef CHILD_PROCESS_H
+#define CHILD_PROCESS_H
+
+#include <sys/types.h>
+
+/// @brief Fork a child process that is killed as soon as the calling process
+/// is gone, so no child outlives a killed main process nor keeps its shared
+/// memory mapped. A child whose parent died before it could ask for that
+/// exits right away.
+/// @return Like fork().
+pid_t fork_dependent_child( void );
+
+#endif
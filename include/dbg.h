@@ -2,6 +2,7 @@
 #define DBG_H
 
 #include <stdio.h>
+#include <unistd.h>
 
 #ifdef DEBUG
 #define loginfo( s, ... ) \
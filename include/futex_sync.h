@@ -0,0 +1,139 @@
+#ifndef FUTEX_SYNC_H
+#define FUTEX_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Synchronization primitives built directly on Linux futexes. They are
+// embedded in shared structs and work between processes and threads alike.
+// Every wait spins for a while before it sleeps in the kernel, and a wakeup
+// is only issued if someone sleeps, so the uncontended path makes no
+// syscalls.
+
+/// @brief One-shot event. Once set, it stays set.
+struct futex_event {
+    uint32_t set;
+    uint32_t waiters;
+    // FUTEX_PRIVATE_FLAG if it is not shared between processes
+    int private_flag;
+};
+typedef struct futex_event futex_event_t;
+
+/// @brief Countdown latch. The waiter is released once it has been counted
+/// down as many times as it was armed to.
+struct futex_latch {
+    uint32_t left;
+    uint32_t waiters;
+    int private_flag;
+};
+typedef struct futex_latch futex_latch_t;
+
+/// @brief Handoff of permits. Whoever takes a permit first gets it, there is
+/// no ordering between the takers.
+struct futex_handoff {
+    uint32_t permits;
+    uint32_t waiters;
+    int private_flag;
+};
+typedef struct futex_handoff futex_handoff_t;
+
+/// @brief One-shot barrier opened by a releaser. Every party arrives and
+/// sleeps on the generation word, the releaser waits until all of them have
+/// arrived and bumps the generation, waking them all with a single syscall.
+/// It may be aborted instead, if not every party is ever going to arrive.
+struct futex_barrier {
+    uint32_t generation;
+    uint32_t arrived;
+    uint32_t parties;
+    // Set before the generation is bumped by `futex_barrier_abort()`
+    uint32_t aborted;
+    int private_flag;
+};
+typedef struct futex_barrier futex_barrier_t;
+
+/// @brief One-shot gate of a single waiter. Cheaper than an event when every
+/// waiter has a gate of its own, opening it wakes exactly that waiter.
+struct futex_gate {
+    uint32_t state;
+    int private_flag;
+};
+typedef struct futex_gate futex_gate_t;
+
+/// @brief Initialize an unset event.
+/// @param event
+/// @param process_shared Whether forked processes use it. Otherwise only
+/// the threads of the calling process do.
+void init_futex_event( futex_event_t *event, bool process_shared );
+
+/// @brief Set the event and release everyone waiting for it.
+void futex_event_set( futex_event_t *event );
+
+/// @brief Block until the event is set.
+void futex_event_wait( futex_event_t *event );
+
+/// @brief Initialize a latch with nothing to count down.
+void init_futex_latch( futex_latch_t *latch, bool process_shared );
+
+/// @brief Expect `count` count downs. The latch must be released.
+void futex_latch_arm( futex_latch_t *latch, int count );
+
+/// @brief Count down once. The last count down releases the waiter.
+void futex_latch_count_down( futex_latch_t *latch );
+
+/// @brief Block until the latch is counted down to zero.
+void futex_latch_wait( futex_latch_t *latch );
+
+/// @brief Initialize a closed barrier for `parties` parties.
+void init_futex_barrier( futex_barrier_t *barrier, int parties,
+                         bool process_shared );
+
+/// @brief Arrive and block until the barrier is opened or aborted.
+/// @return Whether it was opened.
+bool futex_barrier_arrive_and_wait( futex_barrier_t *barrier );
+
+/// @brief Block until every party has arrived, then open the barrier.
+void futex_barrier_release( futex_barrier_t *barrier );
+
+/// @brief Open the barrier if every party arrives within `timeout_ns`.
+/// @return Whether the barrier was opened.
+bool futex_barrier_release_timed( futex_barrier_t *barrier,
+                                  long long timeout_ns );
+
+/// @brief Wake every party waiting at the barrier and let those yet to
+/// arrive through as well, without opening it.
+void futex_barrier_abort( futex_barrier_t *barrier );
+
+/// @brief Initialize a closed gate.
+void init_futex_gate( futex_gate_t *gate, bool process_shared );
+
+/// @brief Open the gate and wake its waiter.
+void futex_gate_open( futex_gate_t *gate );
+
+/// @brief Whether the gate has been opened.
+bool futex_gate_is_open( futex_gate_t *gate );
+
+/// @brief Block until the gate is opened.
+void futex_gate_wait( futex_gate_t *gate );
+
+/// @brief Block until the gate is opened or `timeout_ns` passes.
+/// @return Whether the gate is open.
+bool futex_gate_wait_timed( futex_gate_t *gate, long long timeout_ns );
+
+/// @brief Initialize a handoff without permits.
+void init_futex_handoff( futex_handoff_t *handoff, bool process_shared );
+
+/// @brief Hand `count` permits over to the takers.
+void futex_handoff_grant( futex_handoff_t *handoff, int count );
+
+/// @brief Take a permit if one is available.
+/// @return Whether a permit was taken.
+bool futex_handoff_try_take( futex_handoff_t *handoff );
+
+/// @brief Block until a permit is taken.
+void futex_handoff_take( futex_handoff_t *handoff );
+
+/// @brief Block until a permit is taken or `timeout_ns` passes.
+/// @return Whether a permit was taken.
+bool futex_handoff_take_timed( futex_handoff_t *handoff, long long timeout_ns );
+
+#endif
@@ -1,32 +1,184 @@
 #ifndef JOURNAL_H
 #define JOURNAL_H
 
-#include <stdio.h>
+#include <pthread.h>
 #include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "../include/sharing.h"
+
+/// @brief How entries are written to the journal.
+enum journal_mode {
+    // Entries are written through stdio while holding a shared lock
+    JOURNAL_LOCKED,
+    // Entry numbers come from an atomic counter and every entry is a single
+    // write() on an O_APPEND descriptor. Entries are numbered in the order
+    // the events happened, but may land in the file slightly out of order.
+    // Destroying the journal rewrites them in order.
+    JOURNAL_ATOMIC,
+    // Entries are put into a shared ring buffer and a dedicated writer
+    // drains it in order with large writes
+    JOURNAL_ASYNC,
+    // Entries are written through stdio without locking or flushing. Only
+    // for a journal written by a single thread.
+    JOURNAL_BUFFERED
+};
+typedef enum journal_mode journal_mode_t;
+
+/// @brief How entries are encoded in the output.
+enum journal_format {
+    // "<number>: <actor>: <event>" lines
+    JOURNAL_TEXT,
+    // Fixed-width records, see `journal_decode_binary()`
+    JOURNAL_BINARY,
+    // Fixed-width records with the time of every entry
+    JOURNAL_BINARY_TIMESTAMPED
+};
+typedef enum journal_format journal_format_t;
+
+// Binary journal starts with the magic, an 8-bit version, 8-bit flags and a
+// 16-bit record size. Then records follow, all integers are little-endian:
+// u32 number, u8 actor in the top bit and event in the rest, u24 actor id,
+// u16 stop id and, with JOURNAL_BINARY_FLAG_TIMESTAMPS, u64 microseconds
+// since the journal was opened, or of virtual time. Version 2 had u32
+// microseconds, which wrapped after 71 minutes.
+#define JOURNAL_BINARY_MAGIC "SKIJ"
+enum {
+    JOURNAL_BINARY_VERSION = 3,
+    JOURNAL_BINARY_FLAG_TIMESTAMPS = 1,
+    JOURNAL_BINARY_HEADER_SIZE = 8,
+    JOURNAL_BINARY_RECORD_SIZE = 10,
+    JOURNAL_BINARY_TIMESTAMP_SIZE = 8,
+    JOURNAL_BINARY_MAX_RECORD_SIZE =
+        JOURNAL_BINARY_RECORD_SIZE + JOURNAL_BINARY_TIMESTAMP_SIZE
+};
+
+enum journal_actor { JOURNAL_ACTOR_BUS, JOURNAL_ACTOR_SKIER };
+typedef enum journal_actor journal_actor_t;
+
+enum journal_event {
+    JOURNAL_STARTED,
+    JOURNAL_ARRIVED_TO_STOP,
+    JOURNAL_LEAVING_STOP,
+    JOURNAL_ARRIVED_TO_FINAL,
+    JOURNAL_LEAVING_FINAL,
+    JOURNAL_FINISH,
+    JOURNAL_BOARDING,
+    JOURNAL_GOING_TO_SKI,
+    // Not an entry. Tells the asynchronous writer to finish.
+    JOURNAL_SHUTDOWN
+};
+typedef enum journal_event journal_event_t;
+
+/// @brief A single journal entry before it is formatted.
+struct journal_record {
+    uint32_t number;
+    uint32_t actor_id;
+    uint16_t stop_id;
+    uint8_t actor;
+    uint8_t event;
+    uint64_t timestamp_ns;
+};
+typedef struct journal_record journal_record_t;
+
+enum { JOURNAL_RING_SIZE = 4096 };
+
+struct journal_slot {
+    // Number of the record once it is completely written, 0 before
+    uint32_t published;
+    journal_record_t record;
+};
+typedef struct journal_slot journal_slot_t;
+
+/// @brief Multi-producer single-consumer queue of records. Slot of a record
+/// is given by its number, producers only reserve a free slot by taking the
+/// next number.
+struct journal_ring {
+    // Set once no more records are expected
+    int closing;
+    journal_slot_t slots[ JOURNAL_RING_SIZE ];
+};
+typedef struct journal_ring journal_ring_t;
 
 struct journal {
+    journal_mode_t mode;
+    journal_format_t format;
+    // Timestamps of binary records are relative to this
+    struct timespec opened_at;
+    // When set, records are timestamped by this clock instead
+    const uint64_t *clock_ns;
     sem_t *lock;
     int *message_incr;
     FILE *write_to;
+    // Descriptor of `write_to`, used in JOURNAL_ATOMIC and JOURNAL_ASYNC modes
+    int write_to_fd;
+
+    // Used in JOURNAL_ASYNC mode
+    journal_ring_t *ring;
+    sem_t *ring_free;
+    sem_t *ring_published;
+    bool writer_is_thread;
+    pid_t writer_pid;
+    pthread_t writer_thread;
 };
 typedef struct journal journal_t;
 
+/// @brief Size of the shared memory a journal needs in an arena.
+/// @param mode
+size_t journal_shared_size( journal_mode_t mode );
+
 /// @brief Initialize a singleton journal. Journaling messages are synchronized.
+/// In JOURNAL_ASYNC mode this also starts the writer, as a process if the
+/// arena is shared between processes and as a thread otherwise.
 /// @param journal
+/// @param arena Arena to allocate the shared state from
 /// @param write_to Location to where write the journal entries
+/// @param mode
+/// @param format
 /// @return
-int init_journal( journal_t *journal, FILE* write_to );
+int init_journal( journal_t *journal, shared_arena_t *arena, FILE *write_to,
+                  journal_mode_t mode, journal_format_t format );
 
+/// @brief Release the journal. In JOURNAL_ASYNC mode waits until the writer
+/// has flushed every entry, in JOURNAL_ATOMIC mode puts the entries in the
+/// order of their numbers. No entries may be written concurrently.
 void destroy_journal( journal_t *journal );
 
-void journal_bus( journal_t *journal, char *message );
-void journal_bus_arrived( journal_t *journal, int stop_id );
-void journal_bus_leaving( journal_t *journal, int stop_id );
+/// @brief Kill the writer process of a JOURNAL_ASYNC journal without waiting
+/// for the entries left in the ring. A killed producer may have reserved a
+/// slot it never published, the writer would wait for it forever.
+void abort_journal( journal_t *journal );
+
+/// @brief Format a record as a line of the text journal.
+/// @return Length of the line. 0 if the record is not a valid entry.
+int journal_format_text( char *line, size_t size, journal_record_t *record );
+
+/// @brief Check the header of a binary journal.
+/// @param header `JOURNAL_BINARY_HEADER_SIZE` bytes
+/// @return Size of a record. -1 if it is not a supported binary journal.
+int journal_check_binary_header( const unsigned char *header );
+
+/// @brief Decode a record of a binary journal.
+/// @param bytes The record, its size given by the header
+/// @param record_size As returned by `journal_check_binary_header()`
+/// @param record
+void journal_decode_binary( const unsigned char *bytes, int record_size,
+                            journal_record_t *record );
+
+// Entries of a skibus with bus_id 0 are not labelled, "BUS:". Otherwise they
+// carry the number, "BUS <bus_id>:".
+void journal_bus( journal_t *journal, int bus_id, journal_event_t event );
+void journal_bus_arrived( journal_t *journal, int bus_id, int stop_id );
+void journal_bus_leaving( journal_t *journal, int bus_id, int stop_id );
 
-void journal_skier( journal_t *journal, int skier_id, char *message );
+void journal_skier( journal_t *journal, int skier_id, journal_event_t event );
 void journal_skier_arrived_to_stop( journal_t *journal, int skier_id,
                                     int stop_id );
 void journal_skier_boarding( journal_t *journal, int skier_id );
 void journal_skier_going_to_ski( journal_t *journal, int skier_id );
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,139 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/sharing.h"
+
+// Durations are counted in log-linear buckets: values below
+// 2^METRICS_SUB_BUCKET_BITS ns exactly, every longer power of two split into
+// 2^METRICS_SUB_BUCKET_BITS buckets. Percentiles are off by at most 1/16.
+enum {
+    METRICS_SUB_BUCKET_BITS = 3,
+    METRICS_SUB_BUCKETS = 1 << METRICS_SUB_BUCKET_BITS,
+    // Up to 2^40 ns, about 18 minutes, the last bucket takes the rest
+    METRICS_MAX_EXPONENT = 40,
+    METRICS_BUCKETS = ( METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 1 ) *
+                      METRICS_SUB_BUCKETS
+};
+
+/// @brief Histogram of durations that processes add to concurrently.
+struct metrics_histogram {
+    uint64_t max_ns;
+    uint64_t buckets[ METRICS_BUCKETS ];
+};
+typedef struct metrics_histogram metrics_histogram_t;
+
+/// @brief How skiers and skibuses fared at a bus stop.
+struct stop_metrics {
+    // Skiers that boarded at the stop
+    uint64_t boarded;
+    // Sum of the times they waited from arriving to boarding
+    uint64_t wait_ns;
+    // Skibuses that stopped at the stop
+    uint64_t visits;
+    // Sum of the passengers on board of those skibuses leaving the stop
+    uint64_t load;
+    // Skibuses that drove past the stop, see `arguments_t.skip_empty_stops`
+    uint64_t skips;
+};
+typedef struct stop_metrics stop_metrics_t;
+
+/// @brief Domain statistics of a simulation. The counters live in the shared
+/// memory and every process adds to them with atomics, so they can be read
+/// without locks at any time.
+struct resort_metrics {
+    int stops_amount;
+    int bus_capacity;
+    // Loops of the route finished by the whole fleet
+    uint64_t *trips;
+    // Sum of the passengers skibuses brought to the final stop
+    uint64_t *trips_load;
+    // Earliest and latest "started" entries, the spread of the start
+    uint64_t *first_start_ns;
+    uint64_t *last_start_ns;
+    // Skiers that wrote their "started" entry
+    uint64_t *skiers_started;
+    stop_metrics_t *stops;
+    // Per skier, from starting to arriving to the stop
+    metrics_histogram_t *walk;
+    // Per skier, from boarding to getting out
+    metrics_histogram_t *ride;
+    // Per skier boarding at each stop, from arriving to boarding
+    metrics_histogram_t *waits;
+    // Per skier, skibuses that left the skier's stop or drove past it while
+    // the skier waited. Counts instead of nanoseconds.
+    metrics_histogram_t *passes_waited;
+};
+typedef struct resort_metrics resort_metrics_t;
+
+/// @brief Outcome of a simulation, filled in by `run_simulation()` if the
+/// caller asks for it.
+struct run_report {
+    // From the start to the last "finish" entry. Virtual in virtual time.
+    long long finish_ns;
+    // From the first to the last "started" entry
+    uint64_t start_spread_ns;
+    uint64_t trips;
+    // Most skibuses a skier waited for to pass
+    uint64_t max_passes_waited;
+    // `stops_amount` entries, allocated by the caller
+    stop_metrics_t *stops;
+};
+typedef struct run_report run_report_t;
+
+/// @brief Size of the shared memory the metrics of `stops_amount` stops need
+/// in an arena.
+size_t metrics_shared_size( int stops_amount );
+
+/// @brief Allocate zeroed metrics in the arena.
+/// @return -1 on error. 0 otherwise.
+int init_metrics( resort_metrics_t *metrics, shared_arena_t *arena,
+                  int stops_amount, int bus_capacity );
+
+/// @brief Current time on the clock durations are measured by.
+uint64_t metrics_clock( void );
+
+/// @brief A skier or skibus wrote its "started" entry at `now_ns`.
+void metrics_add_start( resort_metrics_t *metrics, uint64_t now_ns );
+
+/// @brief A skier wrote its "started" entry at `now_ns`.
+void metrics_add_skier_start( resort_metrics_t *metrics, uint64_t now_ns );
+
+/// @brief From the first to the last "started" entry so far.
+uint64_t metrics_start_spread( resort_metrics_t *metrics );
+
+/// @brief A skier arrived to a stop after walking `walk_ns`.
+void metrics_add_walk( resort_metrics_t *metrics, uint64_t walk_ns );
+
+/// @brief A skier boarded at `stop_idx` after waiting `wait_ns`.
+void metrics_add_boarding( resort_metrics_t *metrics, int stop_idx,
+                           uint64_t wait_ns );
+
+/// @brief A skier boarded after `passes` skibuses left without the skier.
+void metrics_add_passes_waited( resort_metrics_t *metrics, uint32_t passes );
+
+/// @brief A skier got out at the final stop after riding `ride_ns`.
+void metrics_add_ride( resort_metrics_t *metrics, uint64_t ride_ns );
+
+/// @brief A skibus leaves `stop_idx` with `passengers` on board.
+void metrics_add_stop_visit( resort_metrics_t *metrics, int stop_idx,
+                             int passengers );
+
+/// @brief A skibus drove past `stop_idx`.
+void metrics_add_stop_skip( resort_metrics_t *metrics, int stop_idx );
+
+/// @brief A skibus finished a loop of the route with `passengers` on board.
+void metrics_add_trip( resort_metrics_t *metrics, int passengers );
+
+/// @brief Copy what was collected so far into a report.
+void fill_run_report( run_report_t *report, resort_metrics_t *metrics,
+                      long long finish_ns );
+
+/// @brief Print percentiles of the durations, the occupancy of skibuses and
+/// the trips.
+void print_metrics( FILE *out, resort_metrics_t *metrics );
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "../include/journal.h"
+#include "../include/ski_resort.h"
+
+// Size of `sun_path` of a Unix socket address on Linux
+enum { METRICS_SOCKET_PATH_MAX_SIZE = 108 };
+
+/// @brief Thread of the main process serving the live counters of a running
+/// simulation on a Unix socket. Every client that connects gets a snapshot,
+/// see `write_metrics_snapshot()`, and the connection is closed.
+struct metrics_server {
+    // -1 if the server is not running
+    int listen_fd;
+    // Readable once the server is asked to stop
+    int stop_fd;
+    pthread_t thread;
+    char *path;
+    ski_resort_t *resort;
+    journal_t *journal;
+};
+typedef struct metrics_server metrics_server_t;
+
+/// @brief Listen on `path` and serve snapshots until the server is stopped.
+/// A socket left behind at `path` by an instance that is gone is replaced,
+/// anything else at `path` is left alone and the server fails.
+/// If it fails, an error message is printed to stderr.
+/// @return -1 on error. 0 otherwise.
+int start_metrics_server( metrics_server_t *server, char *path,
+                          ski_resort_t *resort, journal_t *journal );
+
+/// @brief Stop serving and remove the socket. Does nothing if the server was
+/// not started.
+void stop_metrics_server( metrics_server_t *server );
+
+/// @brief Write the counters as "<name> <values>" lines: skiers started and
+/// at the resort, waiting and walking skiers and boardings of every stop,
+/// the position and load of every skibus, journal entries and, in a
+/// `make prof` build, the waits on the synchronization points. Counters are
+/// read with atomic loads only, never under the simulation's locks, so the
+/// lines may be a little out of step with each other.
+void write_metrics_snapshot( FILE *out, ski_resort_t *resort,
+                             journal_t *journal );
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef MONTE_CARLO_H
+#define MONTE_CARLO_H
+
+#include "../include/ski_resort.h"
+
+/// @brief Run `runs` independent simulations of the configuration in `args`,
+/// `jobs` of them at once. Every run is a process of its own with its own
+/// shared memory and a seed derived from `args->seed`. Journals are discarded
+/// and aggregate statistics of the runs are printed to stdout instead.
+/// @param args
+/// @param runs
+/// @param jobs
+/// @return -1 if any of the runs failed. 0 otherwise.
+int run_monte_carlo( arguments_t *args, int runs, int jobs );
+
+#endif
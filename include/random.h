@@ -1,6 +1,39 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
-int rand_number( int max );
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+/// @brief Independent stream of random numbers of a single entity. Streams
+/// are derived from the seed and the entity id only, so an entity draws the
+/// same numbers no matter which process or thread runs it.
+struct rand_stream {
+    uint64_t state[ 4 ];
+};
+typedef struct rand_stream rand_stream_t;
+
+// Entity id of the stream of a skibus of the fleet, skiers use their ids
+#define RAND_STREAM_SKIBUS( bus_idx ) ( UINT64_MAX - (uint64_t)( bus_idx ) )
+
+/// @brief Set the seed all streams are derived from. Must be called before
+/// any stream is created and before child processes are forked.
+void set_rand_seed( uint64_t seed );
+
+/// @brief Seed that differs between runs, for when none is given.
+uint64_t random_seed( void );
+
+/// @brief Seed of the `index`-th of many simulations sharing a base seed.
+/// Neighbouring indexes give unrelated seeds.
+uint64_t derive_seed( uint64_t seed, uint64_t index );
+
+/// @brief Create the stream of an entity.
+/// @param stream
+/// @param entity_id
+void init_rand_stream( rand_stream_t *stream, uint64_t entity_id );
+
+/// @brief Draw a uniformly distributed number.
+/// @param stream
+/// @param max
+/// @return Number in 1..max. 0 if max is not positive.
+int rand_number( rand_stream_t *stream, int max );
+
+#endif
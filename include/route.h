@@ -0,0 +1,49 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "../include/random.h"
+
+// Longest line of a route file
+enum { ROUTE_LINE_MAX_SIZE = 256 };
+
+/// @brief Ride times of the segments of the skibus route. Segment `i` leads
+/// to stop `i + 1`, the first one from the final stop. The final stop is
+/// right behind the last stop, getting there takes no time.
+struct route {
+    int stops_amount;
+    // Prefix sums of the shortest and longest rides of the segments in
+    // microseconds, `stops_amount + 1` of them starting with 0. A ride over
+    // any run of segments is looked up in constant time.
+    int *min_us;
+    int *max_us;
+};
+typedef struct route route_t;
+
+/// @brief Route of `stops_amount` stops, every ride takes up to
+/// `max_ride_us`.
+/// @return -1 on error. 0 otherwise.
+int init_uniform_route( route_t *route, int stops_amount, int max_ride_us );
+
+/// @brief Read a route from a text file. Every line is a segment,
+/// "<shortest> <longest>" ride in microseconds, empty lines and lines
+/// starting with '#' are skipped. If it fails, an error message is printed
+/// to stderr.
+/// @param route
+/// @param path
+/// @param max_stops Most segments the route may have
+/// @param max_ride_us Longest ride a segment may take
+/// @return -1 on error. 0 otherwise.
+int load_route( route_t *route, const char *path, int max_stops,
+                int max_ride_us );
+
+void destroy_route( route_t *route );
+
+/// @brief Draw how long the ride over segments `first_idx` to `last_idx`
+/// takes, uniformly between the sums of their shortest and longest rides.
+/// A ride over a single segment of the uniform route draws the same numbers
+/// as `rand_number( random, max_ride_us )`.
+/// @return Microseconds.
+int route_ride_time( route_t *route, int first_idx, int last_idx,
+                     rand_stream_t *random );
+
+#endif
@@ -2,21 +2,76 @@
 #define SHARING_H
 
 #include <semaphore.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-/// @brief Initialize an unnamed semaphore in shared memory.
+enum { SHARED_ARENA_NAME_MAX_SIZE = 64 };
+
+// Every object of an arena starts on its own cache line
+enum { CACHE_LINE_SIZE = 64 };
+
+// Shared structs whose instances must not share cache lines
+#define CACHE_LINE_ALIGNED __attribute__( ( aligned( CACHE_LINE_SIZE ) ) )
+
+/// @brief A single shared memory segment that every shared object of the
+/// program is carved from. Objects are never freed one by one, the whole arena
+/// is released at once.
+struct shared_arena {
+    char *base;
+    size_t size;
+    size_t used;
+    // Objects are visible to forked processes, not only to threads
+    bool process_shared;
+    // Empty if the segment is not backed by a named shared memory object
+    char shm_name[ SHARED_ARENA_NAME_MAX_SIZE ];
+};
+typedef struct shared_arena shared_arena_t;
+
+/// @brief Size an object of `size` bytes takes in an arena, alignment
+/// included. Use it to compute the size of an arena up front.
+size_t shared_object_size( size_t size );
+
+/// @brief Write a shared memory name unique to this instance of the program,
+/// "/<base>.<pid>.<nonce>", into `name`.
+/// @param name At least SHARED_ARENA_NAME_MAX_SIZE bytes
+/// @param base
+void instance_shm_name( char *name, const char *base );
+
+/// @brief Remove the shared memory left behind by instances whose process
+/// is gone, as named by `instance_shm_name()`, with any suffix.
+/// @return Number of removed segments.
+int sweep_stale_shm( const char *base );
+
+/// @brief Map a shared memory segment of at least `size` bytes.
+/// @param arena
+/// @param size Sum of `shared_object_size()` of all objects to be allocated.
+/// @param shm_name Shared memory location. Fails with EEXIST if another
+/// segment of the name exists.
+/// @param process_shared Whether forked processes must see the objects.
+/// Otherwise the memory is private to the threads of the calling process.
+/// @param huge_pages Try to back the arena by huge pages. Falls back to
+/// regular pages if they are not available.
+/// @return -1 on error. 0 otherwise.
+int init_shared_arena( shared_arena_t *arena, size_t size, char *shm_name,
+                       bool process_shared, bool huge_pages );
+
+/// @brief Unmap the arena and remove its shared memory object. All objects
+/// allocated from it are invalidated.
+void destroy_shared_arena( shared_arena_t *arena );
+
+/// @brief Initialize an unnamed semaphore in the arena.
+/// @param arena
 /// @param sem A pointer to a pointer that should point to a semaphore.
 /// @param val Initial semaphore value.
-/// @param shm_name Shared memory location. Must be unique per program.
 /// @return -1 on error. 0 otherwise.
-int init_semaphore(sem_t **sem, int val, char *shm_name);
-void destroy_semaphore(sem_t **sem, char *shm_name);
+int init_semaphore( shared_arena_t *arena, sem_t **sem, int val );
+void destroy_semaphore( sem_t **sem );
 
-/// @brief Initialize a variable in shared memory of specified size.
+/// @brief Initialize a zeroed variable in the arena of specified size.
+/// @param arena
 /// @param ppdata A pointer to a pointer that should point to the variable.
 /// @param size Size in bytes to allocate
-/// @param shm_name Shared memory location. Must be unique per program.
 /// @return -1 on error. 0 otherwise.
-int init_shared_var(void **ppdata, size_t size, char *shm_name);
-void destroy_shared_var( void **ppdata, size_t size, char *shm_name );
+int init_shared_var( shared_arena_t *arena, void **ppdata, size_t size );
 
 #endif
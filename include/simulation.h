@@ -1,17 +1,74 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
 
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
 #include "../include/journal.h"
+#include "../include/metrics_server.h"
+#include "../include/sharing.h"
 #include "../include/ski_resort.h"
 
+// Shared memory of a simulation is named after this by `instance_shm_name()`
+// unless a name is given
+#define SHM_ARENA_BASE_NAME "ski_resort"
+
+/// @brief Everything a skier thread needs to run.
+struct skier_thread_args {
+    struct simulation *simulation;
+    int skier_id;
+};
+typedef struct skier_thread_args skier_thread_args_t;
+
+/// @brief Everything a skibus thread needs to run.
+struct skibus_thread_args {
+    struct simulation *simulation;
+    int bus_idx;
+};
+typedef struct skibus_thread_args skibus_thread_args_t;
+
 struct simulation {
+    // Holds the shared state of the journal and the ski resort
+    shared_arena_t arena;
     journal_t journal;
     ski_resort_t ski_resort;
-    pid_t skibus_pid;
-    pid_t *skier_pids;
+    execution_mode_t execution_mode;
+    // Serves the counters of `ski_resort` while it runs, if asked to
+    metrics_server_t metrics_server;
+
+    // Used when running in EXEC_PROCESSES and EXEC_WORKERS modes
+    // A process per skibus of the fleet and per skier or skier worker. They
+    // all join a process group of their own, so a single kill tears them
+    // down. 0 until the first one is forked.
+    pid_t process_group;
+    // Processes forked and not reaped yet
+    int processes_running;
+    int workers_amount;
+    // Delivers SIGCHLD and the signals terminating the main process, which
+    // are blocked while the processes run. -1 if not supervising.
+    int signal_fd;
+    // Signal mask of the main process from before, restored in the children
+    sigset_t signal_mask;
+
+    // Used when running in EXEC_THREADS mode
+    pthread_t *skibus_threads;
+    skibus_thread_args_t *skibus_thread_args;
+    int skibus_threads_amount;
+    pthread_t *skier_threads;
+    skier_thread_args_t *skier_thread_args;
 };
 typedef struct simulation simulation_t;
 
+// Printed to stderr with --timing: time from starting the ski resort to the
+// last "finish" entry and the number of journal entries
+#define TIMING_REPORT_FORMAT "timing: %lld ns to finish, %d journal entries\n"
+
+/// @brief Print the timing report of a finished simulation to stderr.
+/// @param simulation_ns Time from the start to the last "finish" entry
+/// @param journal
+void print_timing_report( long long simulation_ns, journal_t *journal );
+
 /// @brief Run a simulation of a ski resort as specified in the project
 /// requirements. If it fails, an error message is printed to stderr and -1 is
 /// returned.
@@ -2,71 +2,232 @@
 #define SKI_RESORT_H
 
 #include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
 
+#include "../include/futex_sync.h"
 #include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/route.h"
+#include "../include/sharing.h"
+#include "../include/stop_bitmap.h"
+
+/// @brief How the skibus and skiers are executed.
+enum execution_mode {
+    // Every skier and the skibus is a separate process
+    EXEC_PROCESSES,
+    // Every skier and the skibus is a thread of the main process
+    EXEC_THREADS,
+    // The skibus is a process and skiers are multiplexed over a few worker
+    // processes, see `skier_worker_behavior()`
+    EXEC_WORKERS,
+    // Single-threaded discrete-event simulation in virtual time, see
+    // `run_virtual_time_simulation()`
+    EXEC_VIRTUAL_TIME
+};
+typedef enum execution_mode execution_mode_t;
 
 struct arguments {
     int skiers_amount;
     int stops_amount;
     int bus_capacity;
+    // Size of the skibus fleet
+    int buses_amount;
+    // Journal entries of a skibus carry its number, "BUS 2:"
+    bool label_buses;
     int max_walk_to_stop_time;
     int max_ride_to_stop_time;
+    // Ride times of the route's `stops_amount` segments, shared with every
+    // process forked later
+    route_t *route;
+    execution_mode_t execution_mode;
+    // Number of skier worker processes in EXEC_WORKERS mode
+    int workers_amount;
+    // Back the shared memory by huge pages when possible
+    bool huge_pages;
+    journal_mode_t journal_mode;
+    journal_format_t journal_format;
+    // Random streams of the skibus and skiers are derived from this
+    uint64_t seed;
+    // Print how long the simulation took, see `TIMING_REPORT_FORMAT`
+    bool report_timing;
+    // Print the metrics of the simulation, see `print_metrics()`
+    bool print_metrics;
+    // Skibuses skip stops nobody waits at nor walks to, see
+    // `ski_resort_t.stops_with_demand`. A ride past skipped stops takes as
+    // long as their segments together, see `route_ride_time()`.
+    bool skip_empty_stops;
     FILE *output;
+    // Name of the shared memory arena, NULL for one unique to the instance,
+    // see `instance_shm_name()`. Runs of a Monte Carlo simulation append
+    // their numbers to it.
+    char *shm_name;
+    // Unix socket the main process serves live counters on, NULL for none,
+    // see `start_metrics_server()`
+    char *metrics_socket;
+    // Filled in by `run_simulation()` if not NULL
+    run_report_t *report;
 };
 typedef struct arguments arguments_t;
 
+/// @brief A skibus of the fleet. Lives in the shared memory on a cache line
+/// of its own, with the objects its passengers synchronize on.
 struct skibus {
+    // Index into `ski_resort_t.buses`
+    int bus_idx;
+    // Number in the journal, 0 if skibuses are not labelled
+    int journal_id;
     int capacity;
+    // Only the skibus writes it, with atomic stores as the metrics server
+    // reads it, see `write_metrics_snapshot()`
     int capacity_taken;
-    int max_ride_to_stop_time;
-    sem_t *sem_in_done;
-    sem_t *sem_out;
-    sem_t *sem_out_done;
-};
+    // Stop the skibus drives to or stands at, 0 for the final stop
+    int position;
+    // Counted down by every skier of the current boarding batch
+    futex_latch_t boarding_done;
+    // A permit per passenger at the final stop
+    futex_handoff_t get_out;
+    // Counted down by every passenger getting out
+    futex_latch_t unloading_done;
+} CACHE_LINE_ALIGNED;
 typedef struct skibus skibus_t;
 
-struct bus_stop {
-    int *waiting_skiers_amount;
-    sem_t *enter_stop_lock;
-    sem_t *enter_bus_lock;
+/// @brief Place of a skier in the queue at a bus stop.
+struct stop_ticket {
+    // Opened by the skibus once it is the skier's turn to board
+    futex_gate_t enter_bus;
+    // `bus_stop_t.passes` when the skier arrived
+    uint32_t passes_at_arrival;
 };
+typedef struct stop_ticket stop_ticket_t;
+
+/// @brief A bus stop in the shared memory. Everything arriving skiers and a
+/// boarding skibus touch is on the first cache line, the bay lock only
+/// skibuses take is on the second one.
+struct bus_stop {
+    sem_t enter_stop_lock;
+    int waiting_skiers_amount;
+    // Skiers that are still walking to the stop
+    int skiers_en_route;
+    // Index of the skibus holding the bay, skiers board that one
+    int boarding_bus;
+    // Skiers board in the order they arrived. Each takes the next ticket of
+    // the stop's range of `ski_resort_t.tickets` under the enter stop lock,
+    // the boarding skibus opens them in order.
+    int first_ticket;
+    int tickets_issued;
+    int tickets_admitted;
+    // Skibuses that left the stop or drove past it
+    uint32_t passes;
+    // Held by the skibus boarding at the stop, so only one boards at a time
+    sem_t bay_lock CACHE_LINE_ALIGNED;
+} CACHE_LINE_ALIGNED;
 typedef struct bus_stop bus_stop_t;
 
 /// @brief Core struct representing the program's universe.
 struct ski_resort {
-    // Programs starts running once this semaphore is unlocked
-    sem_t *start_lock;
+    // Every skibus and skier program arrives at it, the main program opens
+    // it once they all have
+    futex_barrier_t *start;
 
-    skibus_t bus;
+    // Fleet of skibuses, in the shared memory
+    skibus_t *buses;
+    int buses_amount;
 
     int skiers_amount;
-    int skiers_at_resort;
+    // Shared by the skibuses
+    int *skiers_at_resort;
+    // Set once every skier got to the resort. Skibuses with nothing left to
+    // pick up wait for it.
+    futex_event_t *everyone_at_resort;
+    // CLOCK_MONOTONIC time of the last "finish" entry of a skibus
+    uint64_t *finished_at_ns;
 
     int max_walk_to_stop_time;
     int stops_amount;
+    route_t *route;
     bus_stop_t *stops;
+    // A ticket per skier. Every stop has a range as long as the number of
+    // skiers walking to it.
+    stop_ticket_t *tickets;
+    // Stops someone waits at or walks to. Waiting and walking skiers are
+    // only ever taken away from a stop, so once a stop is removed it stays
+    // removed and skibuses can look up the next one without locking.
+    stop_bitmap_t stops_with_demand;
+    bool skip_empty_stops;
+
+    resort_metrics_t metrics;
 };
 typedef struct ski_resort ski_resort_t;
 
-/// @brief 
-/// @param max 
-/// @return 
-int rand_number( int max );
+/// @brief Size of the shared memory a ski resort needs in an arena.
+size_t ski_resort_shared_size( arguments_t *args );
 
-int init_ski_resort( arguments_t *args, ski_resort_t *resort );
+int init_ski_resort( arguments_t *args, ski_resort_t *resort,
+                     shared_arena_t *arena );
+/// @brief Wait until every skibus and skier program is waiting for the
+/// start, then start them all at once.
 int start_ski_resort(ski_resort_t *resort);
+
+/// @brief Like `start_ski_resort()`, but give up if not every program is
+/// waiting for the start within `timeout_ns`.
+/// @return Whether the ski resort was started.
+bool try_start_ski_resort( ski_resort_t *resort, long long timeout_ns );
+
+/// @brief Call the start off. Programs waiting for it and those yet to wait
+/// return without running.
+void abort_ski_resort_start( ski_resort_t *resort );
 void destroy_ski_resort( ski_resort_t *resort );
 
-/// @brief Representation of what a skibus does during its lifetime
+/// @brief Representation of what a skibus does during its lifetime. Used by
+/// both a skibus process and a skibus thread.
 /// @param resort A valid pointer to an initialized structure is expected
+/// @param bus_idx Which skibus of the fleet
 /// @param journal A valid pointer to an initialized structure is expected
-void skibus_process_behavior( ski_resort_t *resort, journal_t *journal );
+/// @return -1 if the simulation ended up in an invalid state. 0 otherwise.
+int skibus_process_behavior( ski_resort_t *resort, int bus_idx,
+                             journal_t *journal );
+
+/// @brief Block until the ski resort is started.
+/// @return false if the start was called off, see
+/// `abort_ski_resort_start()`.
+bool wait_for_start( ski_resort_t *resort );
+
+// Steps of a skier's lifetime that do not block. Used by
+// `skier_process_behavior()` and by skier workers, which multiplex many skiers
+// in one process.
+
+/// @brief Draw the stop a skier goes to and how long the walk there takes,
+/// from the skier's own random stream.
+void plan_skier( ski_resort_t *resort, int skier_id, int *bus_stop_id,
+                 int *time_to_stop );
+
+// Every step adds how long it took the skier to get to it to the metrics.
+// `since` is when the previous step was done, see `metrics_clock()`, and is
+// set to when this one is.
 
-/// @brief Representation of what a skibus does during its lifetime
+/// @brief Skier has walked to the stop and starts waiting for the bus.
+/// @return Ticket of the skier's place in the queue.
+stop_ticket_t *skier_arrive_at_stop( ski_resort_t *resort, int skier_id,
+                                     int bus_stop_id, uint64_t *since,
+                                     journal_t *journal );
+
+/// @brief The skier's ticket was opened and the skier boards.
+/// @return Index of the skibus the skier boarded.
+int skier_board( ski_resort_t *resort, int skier_id, int bus_stop_id,
+                 stop_ticket_t *ticket, uint64_t *since, journal_t *journal );
+
+/// @brief Skier got a permit of the bus's `get_out` and goes to ski.
+void skier_get_out( ski_resort_t *resort, int bus_idx, int skier_id,
+                    uint64_t *since, journal_t *journal );
+
+/// @brief Representation of what a skier does during its lifetime. Used by
+/// both a skier process and a skier thread.
 /// @param resort A valid pointer to an initialized structure is expected
 /// @param skier_id
 /// @param journal A valid pointer to an initialized structure is expected
-void skier_process_behavior( ski_resort_t *resort, int skier_id, int bus_stop_id,
-                             journal_t *journal );
+/// @return -1 on error. 0 otherwise.
+int skier_process_behavior( ski_resort_t *resort, int skier_id,
+                            journal_t *journal );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef SKIER_WORKER_H
+#define SKIER_WORKER_H
+
+#include "../include/journal.h"
+#include "../include/ski_resort.h"
+
+/// @brief Run skiers with ids first_skier_id..first_skier_id+skiers_amount-1
+/// in the calling process. Every skier is a state machine going through the
+/// same steps as `skier_process_behavior()`. Walks are kept in a timer queue
+/// and waits for the bus are non-blocking, so a single process can host
+/// thousands of skiers.
+/// @param resort A valid pointer to an initialized structure is expected
+/// @param first_skier_id
+/// @param skiers_amount
+/// @param journal A valid pointer to an initialized structure is expected
+/// @return -1 on error. 0 otherwise.
+int skier_worker_behavior( ski_resort_t *resort, int first_skier_id,
+                           int skiers_amount, journal_t *journal );
+
+#endif
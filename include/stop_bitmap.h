@@ -0,0 +1,51 @@
+#ifndef STOP_BITMAP_H
+#define STOP_BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64^4 stops, more than any route has
+enum { STOP_BITMAP_MAX_LEVELS = 4 };
+
+/// @brief Set of stops as a hierarchical bitmap. The first level has a bit
+/// per stop, every level above a bit per nonzero word of the level below,
+/// up to a single word. Finding the next stop of the set reads a word or two
+/// per level instead of scanning the whole route.
+///
+/// Stops are only ever removed once the set is filled in, so a word that
+/// became zero stays zero. Removing is safe from many processes at once and
+/// lookups need no lock, they may only see a stop a little longer.
+struct stop_bitmap {
+    int stops_amount;
+    int levels;
+    // Words of all the levels, the level of stops first. Usually in the
+    // shared memory, the struct itself is private to every process.
+    uint64_t *words;
+    int level_offset[ STOP_BITMAP_MAX_LEVELS ];
+    // Bits in use of every level
+    int level_bits[ STOP_BITMAP_MAX_LEVELS ];
+};
+typedef struct stop_bitmap stop_bitmap_t;
+
+/// @brief Number of words a bitmap of `stops_amount` stops takes.
+size_t stop_bitmap_words( int stops_amount );
+
+/// @brief Initialize an empty bitmap over zeroed `words`.
+/// @param bitmap
+/// @param words `stop_bitmap_words()` zeroed words
+/// @param stops_amount
+void init_stop_bitmap( stop_bitmap_t *bitmap, uint64_t *words,
+                       int stops_amount );
+
+/// @brief Add a stop to the set. Not safe to call concurrently with anything
+/// else, fill the set in before sharing it.
+void stop_bitmap_add( stop_bitmap_t *bitmap, int stop_idx );
+
+/// @brief Remove a stop from the set for good.
+void stop_bitmap_remove( stop_bitmap_t *bitmap, int stop_idx );
+
+/// @brief First stop of the set from `stop_idx` on.
+/// @return `stops_amount` if there is none.
+int stop_bitmap_next( stop_bitmap_t *bitmap, int stop_idx );
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SYNC_STATS_H
+#define SYNC_STATS_H
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/sharing.h"
+
+/// @brief Semaphores and futexes whose waits are measured in an instrumented
+/// build. Waits on the same one of different stops or skibuses add up.
+enum sync_point {
+    SYNC_START,
+    SYNC_JOURNAL_LOCK,
+    SYNC_JOURNAL_RING_FREE,
+    SYNC_JOURNAL_RING_PUBLISHED,
+    SYNC_ENTER_STOP_LOCK,
+    SYNC_ENTER_BUS,
+    SYNC_BAY_LOCK,
+    SYNC_BOARDING_DONE,
+    SYNC_GET_OUT,
+    SYNC_UNLOADING_DONE,
+    SYNC_EVERYONE_AT_RESORT,
+    SYNC_POINTS_AMOUNT
+};
+typedef enum sync_point sync_point_t;
+
+// Built by `make prof`. Otherwise every wait is a plain call and the rest
+// compiles to nothing.
+#ifdef SYNC_STATS
+
+/// @brief Size of the shared memory the wait statistics need in an arena.
+size_t sync_stats_shared_size( void );
+
+/// @brief Allocate zeroed wait statistics in the arena. Must be called before
+/// any process that waits is forked.
+/// @return -1 on error. 0 otherwise.
+int init_sync_stats( shared_arena_t *arena );
+
+/// @brief CLOCK_MONOTONIC time a measured wait starts at.
+uint64_t sync_stats_clock( void );
+
+/// @brief Add a wait that started at `started_at` and ends now to the
+/// histogram of `point`.
+void sync_stats_add( sync_point_t point, uint64_t started_at );
+
+/// @brief `sem_wait()` that adds how long it blocked to the histogram of
+/// `point`.
+int sync_stats_wait( sem_t *sem, sync_point_t point );
+
+/// @brief Print a table of the waits of every point that was waited on.
+void print_sync_stats( FILE *out );
+
+/// @brief Print the waits so far and how long they took in total, a
+/// "lock_wait <point> <waits> <total ns>" line per point. Reads the counters
+/// with atomic loads, so it may be called while the simulation runs.
+void print_sync_stats_totals( FILE *out );
+
+#define timed_sem_wait( sem, point ) sync_stats_wait( sem, point )
+
+/// @brief Measure a wait whose result is not needed, such as a futex one.
+#define timed_wait( point, wait )                                 \
+    do {                                                          \
+        uint64_t sync_stats_started_at = sync_stats_clock();      \
+        wait;                                                     \
+        sync_stats_add( point, sync_stats_started_at );           \
+    } while ( 0 )
+
+#else
+
+#define sync_stats_shared_size() ( (size_t)0 )
+#define init_sync_stats( arena ) ( (void)( arena ), 0 )
+#define print_sync_stats( out ) ( (void)( out ) )
+#define print_sync_stats_totals( out ) ( (void)( out ) )
+#define timed_sem_wait( sem, point ) sem_wait( sem )
+#define timed_wait( point, wait ) wait
+
+#endif
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef VIRTUAL_TIME_H
+#define VIRTUAL_TIME_H
+
+#include "../include/ski_resort.h"
+
+/// @brief Run the simulation in virtual time. A single thread processes
+/// timestamped events in the order of their time, walks and rides take no
+/// real time. Journal entries follow the same rules as in the other modes.
+/// If it fails, an error message is printed to stderr and -1 is returned.
+/// @param args
+int run_virtual_time_simulation( arguments_t *args );
+
+#endif
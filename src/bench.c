@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/child_process.h"
+#include "../include/simulation.h"
+
+#define DEFAULT_OUTPUT_FILENAME "bench.csv"
+#define DEFAULT_PROJ2_PATH "./proj2"
+// Every point runs the same workload in every benchmark
+#define BENCH_SEED "--seed=1"
+
+static const char HELP_TEXT[] =
+    "Usage: ./proj2-bench [OPTIONS] [-- PROJ2_OPTIONS]\n"
+    "\n"
+    "Run ./proj2 over a grid of L, Z, K, TL and TB and write a CSV with\n"
+    "the median of every point's runs.\n"
+    "\n"
+    "Options:\n"
+    "- --runs=N: runs of every point (default 3)\n"
+    "- --output=FILE: where to write the CSV (default " DEFAULT_OUTPUT_FILENAME
+    ")\n"
+    "- --proj2=PATH: the binary to benchmark (default " DEFAULT_PROJ2_PATH
+    ")\n"
+    "- --quick: leave out the largest L\n"
+    "\n"
+    "PROJ2_OPTIONS are passed to every run, e.g. -- --threads\n";
+
+// Grid of the benchmark, includes the limits of src/main.c
+static const int SKIERS[] = { 1, 1000, 19999 };
+static const int STOPS[] = { 1, 10 };
+static const int BUS_CAPACITIES[] = { 10, 100 };
+static const int WALK_TO_STOP_TIMES[] = { 0, 10000 };
+static const int RIDE_TO_STOP_TIMES[] = { 0, 1000 };
+
+#define LENGTH( array ) ( (int)( sizeof( array ) / sizeof( ( array )[ 0 ] ) ) )
+
+enum { MAX_RUNS = 100, MAX_PROJ2_OPTIONS = 32, NUMBER_SIZE = 16 };
+
+enum { DECIMAL_BASE = 10 };
+
+// Enough for the timing report, the rest of stderr is dropped
+enum { STDERR_BUFFER_SIZE = 4096 };
+
+struct bench_point {
+    int skiers_amount;
+    int stops_amount;
+    int bus_capacity;
+    int max_walk_to_stop_time;
+    int max_ride_to_stop_time;
+};
+typedef struct bench_point bench_point_t;
+
+/// @brief Measurements of a single run of ./proj2.
+struct bench_run {
+    double wall_s;
+    double user_s;
+    double sys_s;
+    long max_rss_kib;
+    int journal_entries;
+    double start_to_finish_s;
+};
+typedef struct bench_run bench_run_t;
+
+struct bench_options {
+    int runs;
+    char *output_name;
+    char *proj2_path;
+    bool quick;
+    char *proj2_options[ MAX_PROJ2_OPTIONS ];
+    int proj2_options_amount;
+};
+typedef struct bench_options bench_options_t;
+
+static double timeval_s( struct timeval *time ) {
+    return (double)time->tv_sec + (double)time->tv_usec / 1e6;
+}
+
+static double monotonic_s( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/// @brief Run ./proj2 once with the point's arguments.
+/// @return -1 if it could not run or failed. 0 otherwise.
+static int run_point( bench_options_t *options, bench_point_t *point,
+                      bench_run_t *run ) {
+    char numbers[ 5 ][ NUMBER_SIZE ];
+    (void)snprintf( numbers[ 0 ], NUMBER_SIZE, "%i", point->skiers_amount );
+    (void)snprintf( numbers[ 1 ], NUMBER_SIZE, "%i", point->stops_amount );
+    (void)snprintf( numbers[ 2 ], NUMBER_SIZE, "%i", point->bus_capacity );
+    (void)snprintf( numbers[ 3 ], NUMBER_SIZE, "%i",
+                    point->max_walk_to_stop_time );
+    (void)snprintf( numbers[ 4 ], NUMBER_SIZE, "%i",
+                    point->max_ride_to_stop_time );
+
+    char *argv[ MAX_PROJ2_OPTIONS + 9 ];
+    int argc = 0;
+    argv[ argc++ ] = options->proj2_path;
+    argv[ argc++ ] = "--timing";
+    argv[ argc++ ] = BENCH_SEED;
+    // Passed later, so they may override the seed
+    for ( int i = 0; i < options->proj2_options_amount; i++ ) {
+        argv[ argc++ ] = options->proj2_options[ i ];
+    }
+    for ( int i = 0; i < 5; i++ ) {
+        argv[ argc++ ] = numbers[ i ];
+    }
+    argv[ argc ] = NULL;
+
+    int stderr_pipe[ 2 ];
+    if ( pipe( stderr_pipe ) == -1 ) {
+        return -1;
+    }
+
+    double started_at = monotonic_s();
+    // A killed benchmark does not leave the simulation running
+    pid_t pid = fork_dependent_child();
+    if ( pid < 0 ) {
+        close( stderr_pipe[ 0 ] );
+        close( stderr_pipe[ 1 ] );
+        return -1;
+    }
+    if ( pid == 0 ) {
+        int null_fd = open( "/dev/null", O_WRONLY | O_CLOEXEC );
+        if ( null_fd != -1 ) {
+            dup2( null_fd, STDOUT_FILENO );
+        }
+        dup2( stderr_pipe[ 1 ], STDERR_FILENO );
+        close( stderr_pipe[ 0 ] );
+        close( stderr_pipe[ 1 ] );
+        execv( options->proj2_path, argv );
+        _exit( EXIT_FAILURE );
+    }
+    close( stderr_pipe[ 1 ] );
+
+    // Read everything, so the child never blocks on a full pipe
+    char output[ STDERR_BUFFER_SIZE ];
+    size_t output_size = 0;
+    char discard[ STDERR_BUFFER_SIZE ];
+    ssize_t got = 0;
+    while ( ( got = read( stderr_pipe[ 0 ], discard, sizeof( discard ) ) ) !=
+            0 ) {
+        if ( got == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            break;
+        }
+        size_t to_keep = (size_t)got;
+        if ( to_keep > sizeof( output ) - 1 - output_size ) {
+            to_keep = sizeof( output ) - 1 - output_size;
+        }
+        memcpy( output + output_size, discard, to_keep );
+        output_size += to_keep;
+    }
+    output[ output_size ] = '\0';
+    close( stderr_pipe[ 0 ] );
+
+    int status = 0;
+    struct rusage usage;
+    if ( wait4( pid, &status, 0, &usage ) == -1 ) {
+        return -1;
+    }
+    run->wall_s = monotonic_s() - started_at;
+
+    if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != EXIT_SUCCESS ) {
+        (void)fprintf( stderr, "%s failed: %s", options->proj2_path, output );
+        return -1;
+    }
+
+    run->user_s = timeval_s( &usage.ru_utime );
+    run->sys_s = timeval_s( &usage.ru_stime );
+    // Peak of the largest process, children included on Linux
+    run->max_rss_kib = usage.ru_maxrss;
+
+    long long start_to_finish_ns = 0;
+    char *report = strstr( output, "timing:" );
+    if ( report == NULL ||
+         sscanf( report, TIMING_REPORT_FORMAT, &start_to_finish_ns,
+                 &run->journal_entries ) != 2 ) {
+        (void)fprintf( stderr, "%s did not report timing\n",
+                       options->proj2_path );
+        return -1;
+    }
+    run->start_to_finish_s = (double)start_to_finish_ns / 1e9;
+    return 0;
+}
+
+static int compare_doubles( const void *a, const void *b ) {
+    double value_a = *(const double *)a;
+    double value_b = *(const double *)b;
+    return ( value_a > value_b ) - ( value_a < value_b );
+}
+
+/// @brief Median of a field of the runs.
+static double median( bench_run_t *runs, int runs_amount,
+                      double ( *field )( bench_run_t *run ) ) {
+    double values[ MAX_RUNS ];
+    for ( int i = 0; i < runs_amount; i++ ) {
+        values[ i ] = field( &runs[ i ] );
+    }
+    qsort( values, (size_t)runs_amount, sizeof( double ), compare_doubles );
+    if ( runs_amount % 2 == 1 ) {
+        return values[ runs_amount / 2 ];
+    }
+    return ( values[ runs_amount / 2 - 1 ] + values[ runs_amount / 2 ] ) / 2;
+}
+
+static double field_wall( bench_run_t *run ) {
+    return run->wall_s;
+}
+static double field_user( bench_run_t *run ) {
+    return run->user_s;
+}
+static double field_sys( bench_run_t *run ) {
+    return run->sys_s;
+}
+static double field_max_rss( bench_run_t *run ) {
+    return (double)run->max_rss_kib;
+}
+static double field_entries( bench_run_t *run ) {
+    return (double)run->journal_entries;
+}
+static double field_entries_per_s( bench_run_t *run ) {
+    return run->wall_s > 0 ? run->journal_entries / run->wall_s : 0;
+}
+static double field_start_to_finish( bench_run_t *run ) {
+    return run->start_to_finish_s;
+}
+
+static int bench_point( bench_options_t *options, bench_point_t *point,
+                        FILE *output ) {
+    bench_run_t runs[ MAX_RUNS ];
+    for ( int i = 0; i < options->runs; i++ ) {
+        if ( run_point( options, point, &runs[ i ] ) == -1 ) {
+            return -1;
+        }
+    }
+
+    (void)fprintf( output,
+                   "%i,%i,%i,%i,%i,%i,%.4f,%.4f,%.4f,%.0f,%.0f,%.0f,%.4f\n",
+                   point->skiers_amount, point->stops_amount,
+                   point->bus_capacity, point->max_walk_to_stop_time,
+                   point->max_ride_to_stop_time, options->runs,
+                   median( runs, options->runs, field_wall ),
+                   median( runs, options->runs, field_user ),
+                   median( runs, options->runs, field_sys ),
+                   median( runs, options->runs, field_max_rss ),
+                   median( runs, options->runs, field_entries ),
+                   median( runs, options->runs, field_entries_per_s ),
+                   median( runs, options->runs, field_start_to_finish ) );
+    (void)fflush( output );
+    return 0;
+}
+
+/// @brief Parse the number of an option, exit with a message if it is not a
+/// positive number.
+static int arg_to_positive_or_exit( const char *option, const char *arg ) {
+    char *end = NULL;
+    long value = strtol( arg, &end, DECIMAL_BASE );
+    if ( *arg == '\0' || *end != '\0' || value < 1 || value > 0x7fffffff ) {
+        (void)fprintf( stderr, "%s must be a positive number\n", option );
+        exit( EXIT_FAILURE );
+    }
+    return (int)value;
+}
+
+int main( int argc, char *argv[] ) {
+    bench_options_t options;
+    options.runs = 3;
+    options.output_name = DEFAULT_OUTPUT_FILENAME;
+    options.proj2_path = DEFAULT_PROJ2_PATH;
+    options.quick = false;
+    options.proj2_options_amount = 0;
+
+    for ( int i = 1; i < argc; i++ ) {
+        if ( strcmp( argv[ i ], "--help" ) == 0 ||
+             strcmp( argv[ i ], "-h" ) == 0 ) {
+            (void)printf( HELP_TEXT );
+            return EXIT_SUCCESS;
+        }
+        if ( strncmp( argv[ i ], "--runs=", strlen( "--runs=" ) ) == 0 ) {
+            options.runs = arg_to_positive_or_exit(
+                "--runs", argv[ i ] + strlen( "--runs=" ) );
+            if ( options.runs > MAX_RUNS ) {
+                (void)fprintf( stderr, "runs must be within 1 and %i\n",
+                               MAX_RUNS );
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--output=", strlen( "--output=" ) ) == 0 ) {
+            options.output_name = argv[ i ] + strlen( "--output=" );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--proj2=", strlen( "--proj2=" ) ) == 0 ) {
+            options.proj2_path = argv[ i ] + strlen( "--proj2=" );
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--quick" ) == 0 ) {
+            options.quick = true;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--" ) == 0 ) {
+            for ( i++; i < argc; i++ ) {
+                if ( options.proj2_options_amount == MAX_PROJ2_OPTIONS ) {
+                    (void)fprintf( stderr, "too many proj2 options\n" );
+                    return EXIT_FAILURE;
+                }
+                options.proj2_options[ options.proj2_options_amount++ ] =
+                    argv[ i ];
+            }
+            break;
+        }
+        (void)fprintf( stderr, "unknown option %s\n", argv[ i ] );
+        return EXIT_FAILURE;
+    }
+
+    FILE *output = fopen( options.output_name, "we" );
+    if ( output == NULL ) {
+        (void)fprintf( stderr, "failed to open %s\n", options.output_name );
+        return EXIT_FAILURE;
+    }
+    (void)fprintf( output, "L,Z,K,TL,TB,runs,wall_s,user_s,sys_s,"
+                           "max_rss_kib,journal_entries,entries_per_s,"
+                           "start_to_finish_s\n" );
+
+    // The quick grid leaves out the largest skier count
+    int skiers_points = LENGTH( SKIERS ) - ( options.quick ? 1 : 0 );
+
+    int result = EXIT_SUCCESS;
+    for ( int l = 0; l < skiers_points; l++ ) {
+        for ( int z = 0; z < LENGTH( STOPS ); z++ ) {
+            for ( int k = 0; k < LENGTH( BUS_CAPACITIES ); k++ ) {
+                for ( int tl = 0; tl < LENGTH( WALK_TO_STOP_TIMES ); tl++ ) {
+                    for ( int tb = 0; tb < LENGTH( RIDE_TO_STOP_TIMES );
+                          tb++ ) {
+                        bench_point_t point = { SKIERS[ l ], STOPS[ z ],
+                                                BUS_CAPACITIES[ k ],
+                                                WALK_TO_STOP_TIMES[ tl ],
+                                                RIDE_TO_STOP_TIMES[ tb ] };
+                        if ( bench_point( &options, &point, output ) == -1 ) {
+                            result = EXIT_FAILURE;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    (void)fclose( output );
+    return result;
+}
@@ -0,0 +1,22 @@
+#include "../include/child_process.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+pid_t fork_dependent_child( void ) {
+    pid_t parent_pid = getpid();
+    pid_t pid = fork();
+    if ( pid != 0 ) {
+        return pid;
+    }
+
+    (void)prctl( PR_SET_PDEATHSIG, SIGKILL );
+    // The parent may have been killed before the request
+    if ( getppid() != parent_pid ) {
+        _exit( EXIT_FAILURE );
+    }
+    return 0;
+}
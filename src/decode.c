@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/journal.h"
+
+#define DEFAULT_INPUT_FILENAME "proj2.bin"
+
+static const char HELP_TEXT[] =
+    "Usage: ./proj2-decode [FILE]\n"
+    "\n"
+    "Decode a binary journal written by ./proj2 --journal-format=binary\n"
+    "into the text journal format. Reads " DEFAULT_INPUT_FILENAME
+    " if FILE is not given\n"
+    "and writes the text to the standard output.\n";
+
+// Records decoded per read()
+enum { RECORDS_PER_CHUNK = 4096 };
+
+// Longest line is "<int>: L <int>: arrived to <int>\n"
+enum { LINE_MAX_SIZE = 128 };
+
+int main( int argc, char *argv[] ) {
+    if ( argc > 2 ) {
+        (void)fprintf( stderr, "too many arguments\n" );
+        return EXIT_FAILURE;
+    }
+    if ( argc == 2 && ( strcmp( argv[ 1 ], "--help" ) == 0 ||
+                        strcmp( argv[ 1 ], "-h" ) == 0 ) ) {
+        (void)printf( HELP_TEXT );
+        return EXIT_SUCCESS;
+    }
+
+    char *input_name = argc == 2 ? argv[ 1 ] : DEFAULT_INPUT_FILENAME;
+    FILE *input = fopen( input_name, "rbe" );
+    if ( input == NULL ) {
+        (void)fprintf( stderr, "failed to open %s\n", input_name );
+        return EXIT_FAILURE;
+    }
+
+    unsigned char header[ JOURNAL_BINARY_HEADER_SIZE ];
+    int record_size = -1;
+    if ( fread( header, 1, sizeof( header ), input ) == sizeof( header ) ) {
+        record_size = journal_check_binary_header( header );
+    }
+    if ( record_size == -1 ) {
+        (void)fprintf( stderr, "%s is not a binary journal\n", input_name );
+        (void)fclose( input );
+        return EXIT_FAILURE;
+    }
+
+    static unsigned char records[ RECORDS_PER_CHUNK *
+                                  JOURNAL_BINARY_MAX_RECORD_SIZE ];
+    static char text[ RECORDS_PER_CHUNK * LINE_MAX_SIZE ];
+
+    // Read bytes, not records, fread() would drop a partial record silently
+    size_t chunk_size = RECORDS_PER_CHUNK * (size_t)record_size;
+    size_t pending = 0;
+    int result = EXIT_SUCCESS;
+    size_t bytes_read = 0;
+    while ( ( bytes_read = fread( records + pending, 1, chunk_size - pending,
+                                  input ) ) > 0 ) {
+        size_t available = pending + bytes_read;
+        size_t records_read = available / (size_t)record_size;
+        size_t text_size = 0;
+        for ( size_t i = 0; i < records_read; i++ ) {
+            journal_record_t record;
+            journal_decode_binary( records + i * (size_t)record_size,
+                                   record_size, &record );
+            int length =
+                journal_format_text( text + text_size, LINE_MAX_SIZE, &record );
+            if ( length == 0 ) {
+                (void)fprintf( stderr, "invalid record number %u\n",
+                               record.number );
+                result = EXIT_FAILURE;
+            }
+            text_size += (size_t)length;
+        }
+        (void)fwrite( text, 1, text_size, stdout );
+
+        // A record cut by the end of a short read is completed by the next
+        pending = available - records_read * (size_t)record_size;
+        memmove( records, records + records_read * (size_t)record_size,
+                 pending );
+    }
+
+    if ( ferror( input ) || !feof( input ) ) {
+        (void)fprintf( stderr, "failed to read %s\n", input_name );
+        result = EXIT_FAILURE;
+    } else if ( pending != 0 ) {
+        (void)fprintf( stderr, "%s ends with a truncated record\n",
+                       input_name );
+        result = EXIT_FAILURE;
+    }
+
+    (void)fclose( input );
+    return result;
+}
@@ -0,0 +1,358 @@
+#include "../include/futex_sync.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// How many times a waiter checks the futex word before it sleeps. A handoff
+// on another CPU usually completes within it.
+enum { FUTEX_SPIN_ITERATIONS = 128 };
+
+// On a single CPU the waker cannot run while the waiter spins
+static int spin_iterations = -1;
+
+enum { NS_PER_S = 1000 * 1000 * 1000 };
+
+// States of a gate. The waiter marks it sleeping before it sleeps, so the
+// opener only wakes it if it does.
+enum { GATE_CLOSED = 0, GATE_SLEEPING = 1, GATE_OPEN = 2 };
+
+static void cpu_relax( void ) {
+#if defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_ia32_pause();
+#elif defined( __aarch64__ )
+    __asm__ __volatile__( "yield" );
+#endif
+}
+
+static int spin_limit( void ) {
+    if ( spin_iterations == -1 ) {
+        spin_iterations =
+            sysconf( _SC_NPROCESSORS_ONLN ) > 1 ? FUTEX_SPIN_ITERATIONS : 0;
+    }
+    return spin_iterations;
+}
+
+static long long monotonic_ns( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * NS_PER_S + now.tv_nsec;
+}
+
+/// @brief Sleep while `*word == expected`, at most `timeout` if not NULL.
+/// Spurious returns are fine, callers check the word again.
+static void futex_wait( uint32_t *word, uint32_t expected, int private_flag,
+                        const struct timespec *timeout ) {
+    (void)syscall( SYS_futex, word, FUTEX_WAIT | private_flag, expected,
+                   timeout, NULL, 0 );
+}
+
+static void futex_wake( uint32_t *word, int count, int private_flag ) {
+    (void)syscall( SYS_futex, word, FUTEX_WAKE | private_flag, count, NULL,
+                   NULL, 0 );
+}
+
+/// @brief Spin until `*word` differs from `unwanted`.
+/// @return Whether it did before the spinning ended.
+static bool spin_while_equal( uint32_t *word, uint32_t unwanted ) {
+    for ( int i = 0; i < spin_limit(); i++ ) {
+        if ( __atomic_load_n( word, __ATOMIC_ACQUIRE ) != unwanted ) {
+            return true;
+        }
+        cpu_relax();
+    }
+    return __atomic_load_n( word, __ATOMIC_ACQUIRE ) != unwanted;
+}
+
+static int private_flag_of( bool process_shared ) {
+    return process_shared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+void init_futex_event( futex_event_t *event, bool process_shared ) {
+    event->set = 0;
+    event->waiters = 0;
+    event->private_flag = private_flag_of( process_shared );
+}
+
+// A waiter announces itself before it checks the word for the last time and
+// a waker changes the word before it checks for waiters. Both are sequentially
+// consistent, so either the waiter sees the change or the waker sees the
+// waiter.
+
+void futex_event_set( futex_event_t *event ) {
+    __atomic_store_n( &event->set, 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &event->waiters, __ATOMIC_SEQ_CST ) > 0 ) {
+        futex_wake( &event->set, INT_MAX, event->private_flag );
+    }
+}
+
+void futex_event_wait( futex_event_t *event ) {
+    if ( spin_while_equal( &event->set, 0 ) ) {
+        return;
+    }
+
+    __atomic_add_fetch( &event->waiters, 1, __ATOMIC_SEQ_CST );
+    while ( __atomic_load_n( &event->set, __ATOMIC_SEQ_CST ) == 0 ) {
+        futex_wait( &event->set, 0, event->private_flag, NULL );
+    }
+    __atomic_sub_fetch( &event->waiters, 1, __ATOMIC_RELAXED );
+}
+
+void init_futex_latch( futex_latch_t *latch, bool process_shared ) {
+    latch->left = 0;
+    latch->waiters = 0;
+    latch->private_flag = private_flag_of( process_shared );
+}
+
+void futex_latch_arm( futex_latch_t *latch, int count ) {
+    __atomic_store_n( &latch->left, (uint32_t)count, __ATOMIC_RELEASE );
+}
+
+void futex_latch_count_down( futex_latch_t *latch ) {
+    if ( __atomic_sub_fetch( &latch->left, 1, __ATOMIC_SEQ_CST ) != 0 ) {
+        return;
+    }
+    if ( __atomic_load_n( &latch->waiters, __ATOMIC_SEQ_CST ) > 0 ) {
+        futex_wake( &latch->left, INT_MAX, latch->private_flag );
+    }
+}
+
+void futex_latch_wait( futex_latch_t *latch ) {
+    for ( int i = 0; i < spin_limit(); i++ ) {
+        if ( __atomic_load_n( &latch->left, __ATOMIC_ACQUIRE ) == 0 ) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    __atomic_add_fetch( &latch->waiters, 1, __ATOMIC_SEQ_CST );
+    uint32_t left;
+    while ( ( left = __atomic_load_n( &latch->left, __ATOMIC_SEQ_CST ) ) !=
+            0 ) {
+        futex_wait( &latch->left, left, latch->private_flag, NULL );
+    }
+    __atomic_sub_fetch( &latch->waiters, 1, __ATOMIC_RELAXED );
+}
+
+void init_futex_barrier( futex_barrier_t *barrier, int parties,
+                         bool process_shared ) {
+    barrier->generation = 0;
+    barrier->arrived = 0;
+    barrier->parties = (uint32_t)parties;
+    barrier->aborted = 0;
+    barrier->private_flag = private_flag_of( process_shared );
+}
+
+// Parties do not announce themselves as waiters, thousands of them would
+// all contend for that word. The releaser wakes the generation word
+// unconditionally instead, it is done only once.
+
+bool futex_barrier_arrive_and_wait( futex_barrier_t *barrier ) {
+    // The barrier cannot open before this party arrives. An abort that
+    // bumped the generation already is seen below.
+    uint32_t generation =
+        __atomic_load_n( &barrier->generation, __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &barrier->aborted, __ATOMIC_ACQUIRE ) ) {
+        return false;
+    }
+    if ( __atomic_add_fetch( &barrier->arrived, 1, __ATOMIC_SEQ_CST ) ==
+         barrier->parties ) {
+        futex_wake( &barrier->arrived, 1, barrier->private_flag );
+    }
+
+    if ( !spin_while_equal( &barrier->generation, generation ) ) {
+        while ( __atomic_load_n( &barrier->generation, __ATOMIC_ACQUIRE ) ==
+                generation ) {
+            futex_wait( &barrier->generation, generation,
+                        barrier->private_flag, NULL );
+        }
+    }
+    return !__atomic_load_n( &barrier->aborted, __ATOMIC_ACQUIRE );
+}
+
+/// @brief Wait for every party until `deadline_ns`, forever if it is
+/// negative, and open the barrier if they all arrived.
+static bool release_until( futex_barrier_t *barrier, long long deadline_ns ) {
+    uint32_t arrived;
+    while ( ( arrived = __atomic_load_n( &barrier->arrived,
+                                         __ATOMIC_SEQ_CST ) ) !=
+            barrier->parties ) {
+        if ( deadline_ns < 0 ) {
+            futex_wait( &barrier->arrived, arrived, barrier->private_flag,
+                        NULL );
+            continue;
+        }
+
+        long long timeout_ns = deadline_ns - monotonic_ns();
+        if ( timeout_ns <= 0 ) {
+            return false;
+        }
+        struct timespec timeout = { (time_t)( timeout_ns / NS_PER_S ),
+                                    (long)( timeout_ns % NS_PER_S ) };
+        futex_wait( &barrier->arrived, arrived, barrier->private_flag,
+                    &timeout );
+    }
+    __atomic_add_fetch( &barrier->generation, 1, __ATOMIC_RELEASE );
+    futex_wake( &barrier->generation, INT_MAX, barrier->private_flag );
+    return true;
+}
+
+void futex_barrier_release( futex_barrier_t *barrier ) {
+    (void)release_until( barrier, -1 );
+}
+
+bool futex_barrier_release_timed( futex_barrier_t *barrier,
+                                  long long timeout_ns ) {
+    return release_until( barrier, monotonic_ns() + timeout_ns );
+}
+
+void futex_barrier_abort( futex_barrier_t *barrier ) {
+    __atomic_store_n( &barrier->aborted, 1, __ATOMIC_RELEASE );
+    __atomic_add_fetch( &barrier->generation, 1, __ATOMIC_RELEASE );
+    futex_wake( &barrier->generation, INT_MAX, barrier->private_flag );
+}
+
+void init_futex_gate( futex_gate_t *gate, bool process_shared ) {
+    gate->state = GATE_CLOSED;
+    gate->private_flag = private_flag_of( process_shared );
+}
+
+void futex_gate_open( futex_gate_t *gate ) {
+    if ( __atomic_exchange_n( &gate->state, GATE_OPEN, __ATOMIC_RELEASE ) ==
+         GATE_SLEEPING ) {
+        futex_wake( &gate->state, 1, gate->private_flag );
+    }
+}
+
+bool futex_gate_is_open( futex_gate_t *gate ) {
+    return __atomic_load_n( &gate->state, __ATOMIC_ACQUIRE ) == GATE_OPEN;
+}
+
+/// @brief Spin for the gate, then sleep for it until `deadline_ns`, forever
+/// if it is negative.
+static bool wait_for_gate( futex_gate_t *gate, long long deadline_ns ) {
+    for ( int i = 0; i < spin_limit(); i++ ) {
+        if ( futex_gate_is_open( gate ) ) {
+            return true;
+        }
+        cpu_relax();
+    }
+
+    // A waiter that timed out before left it sleeping
+    uint32_t state = GATE_CLOSED;
+    if ( !__atomic_compare_exchange_n( &gate->state, &state, GATE_SLEEPING,
+                                       false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_ACQUIRE ) &&
+         state == GATE_OPEN ) {
+        return true;
+    }
+
+    while ( !futex_gate_is_open( gate ) ) {
+        if ( deadline_ns < 0 ) {
+            futex_wait( &gate->state, GATE_SLEEPING, gate->private_flag,
+                        NULL );
+            continue;
+        }
+
+        long long timeout_ns = deadline_ns - monotonic_ns();
+        if ( timeout_ns <= 0 ) {
+            return false;
+        }
+        struct timespec timeout = { (time_t)( timeout_ns / NS_PER_S ),
+                                    (long)( timeout_ns % NS_PER_S ) };
+        futex_wait( &gate->state, GATE_SLEEPING, gate->private_flag,
+                    &timeout );
+    }
+    return true;
+}
+
+void futex_gate_wait( futex_gate_t *gate ) {
+    (void)wait_for_gate( gate, -1 );
+}
+
+bool futex_gate_wait_timed( futex_gate_t *gate, long long timeout_ns ) {
+    if ( futex_gate_is_open( gate ) ) {
+        return true;
+    }
+    if ( timeout_ns <= 0 ) {
+        return false;
+    }
+    return wait_for_gate( gate, monotonic_ns() + timeout_ns );
+}
+
+void init_futex_handoff( futex_handoff_t *handoff, bool process_shared ) {
+    handoff->permits = 0;
+    handoff->waiters = 0;
+    handoff->private_flag = private_flag_of( process_shared );
+}
+
+void futex_handoff_grant( futex_handoff_t *handoff, int count ) {
+    if ( count <= 0 ) {
+        return;
+    }
+    __atomic_add_fetch( &handoff->permits, (uint32_t)count, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &handoff->waiters, __ATOMIC_SEQ_CST ) > 0 ) {
+        futex_wake( &handoff->permits, count, handoff->private_flag );
+    }
+}
+
+bool futex_handoff_try_take( futex_handoff_t *handoff ) {
+    uint32_t permits = __atomic_load_n( &handoff->permits, __ATOMIC_RELAXED );
+    while ( permits > 0 ) {
+        if ( __atomic_compare_exchange_n( &handoff->permits, &permits,
+                                          permits - 1, true, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED ) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Spin for a permit, then sleep for one until `deadline_ns`, forever
+/// if it is negative.
+static bool take_until( futex_handoff_t *handoff, long long deadline_ns ) {
+    for ( int i = 0; i < spin_limit(); i++ ) {
+        if ( futex_handoff_try_take( handoff ) ) {
+            return true;
+        }
+        cpu_relax();
+    }
+
+    bool taken = false;
+    __atomic_add_fetch( &handoff->waiters, 1, __ATOMIC_SEQ_CST );
+    while ( !( taken = futex_handoff_try_take( handoff ) ) ) {
+        if ( deadline_ns < 0 ) {
+            futex_wait( &handoff->permits, 0, handoff->private_flag, NULL );
+            continue;
+        }
+
+        long long timeout_ns = deadline_ns - monotonic_ns();
+        if ( timeout_ns <= 0 ) {
+            break;
+        }
+        struct timespec timeout = { (time_t)( timeout_ns / NS_PER_S ),
+                                    (long)( timeout_ns % NS_PER_S ) };
+        futex_wait( &handoff->permits, 0, handoff->private_flag, &timeout );
+    }
+    __atomic_sub_fetch( &handoff->waiters, 1, __ATOMIC_RELAXED );
+    return taken;
+}
+
+void futex_handoff_take( futex_handoff_t *handoff ) {
+    (void)take_until( handoff, -1 );
+}
+
+bool futex_handoff_take_timed( futex_handoff_t *handoff,
+                               long long timeout_ns ) {
+    if ( futex_handoff_try_take( handoff ) ) {
+        return true;
+    }
+    if ( timeout_ns <= 0 ) {
+        return false;
+    }
+    return take_until( handoff, monotonic_ns() + timeout_ns );
+}
@@ -1,15 +1,60 @@
 #include "../include/journal.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "../include/child_process.h"
 #include "../include/sharing.h"
+#include "../include/sync_stats.h"
 
-#define JOURNAL_NAME "journal"
-#define JOURNAL_INCREMENTER_NAME "journal_incr"
+// Longest entry is "<int>: L <int>: arrived to <int>\n"
+enum { JOURNAL_LINE_MAX_SIZE = 128 };
 
-int init_journal( journal_t *journal, FILE *write_to ) {
+// Every entry bumps the counter. It gets a pair of cache lines to itself, as
+// adjacent lines are often prefetched together.
+enum { JOURNAL_COUNTER_SIZE = 2 * CACHE_LINE_SIZE };
+
+// "BUS <int>"
+enum { JOURNAL_BUS_LABEL_SIZE = 16 };
+
+enum { DECIMAL_BASE = 10 };
+
+// The asynchronous writer flushes once this much text is buffered
+enum { JOURNAL_WRITE_BATCH_SIZE = 64 * 1024 };
+
+// How long the writer waits for a record whose writer may have been killed,
+// once no more records are expected
+enum { JOURNAL_ABANDON_SLOT_NS = 100 * 1000 * 1000 };
+
+static void encode_binary_header( unsigned char *header,
+                                  journal_format_t format );
+static int start_writer( journal_t *journal );
+static void *writer_thread( void *arg );
+static void drain_ring( journal_t *journal );
+static void order_entries( journal_t *journal );
+
+size_t journal_shared_size( journal_mode_t mode ) {
+    size_t size = shared_object_size( JOURNAL_COUNTER_SIZE ) +
+                  shared_object_size( sizeof( sem_t ) );
+    if ( mode == JOURNAL_ASYNC ) {
+        size += shared_object_size( sizeof( journal_ring_t ) ) +
+                2 * shared_object_size( sizeof( sem_t ) );
+    }
+    return size;
+}
+
+int init_journal( journal_t *journal, shared_arena_t *arena, FILE *write_to,
+                  journal_mode_t mode, journal_format_t format ) {
     if ( journal == NULL ) {
         return -1;
     }
@@ -17,21 +62,63 @@ int init_journal( journal_t *journal, FILE *write_to ) {
         return -1;
     }
 
+    journal->mode = mode;
+    journal->format = format;
+    clock_gettime( CLOCK_MONOTONIC, &journal->opened_at );
+    journal->clock_ns = NULL;
     journal->write_to = write_to;
+    journal->write_to_fd = fileno( write_to );
+    journal->ring = NULL;
+    journal->ring_free = NULL;
+    journal->ring_published = NULL;
+    journal->writer_is_thread = !arena->process_shared;
+
+    if ( mode == JOURNAL_ATOMIC ) {
+        // Appends of concurrent writers must not overwrite each other
+        int flags = fcntl( journal->write_to_fd, F_GETFL );
+        if ( flags == -1 ||
+             fcntl( journal->write_to_fd, F_SETFL, flags | O_APPEND ) == -1 ) {
+            return -1;
+        }
+    }
+
+    if ( format != JOURNAL_TEXT ) {
+        unsigned char header[ JOURNAL_BINARY_HEADER_SIZE ];
+        encode_binary_header( header, format );
+        if ( fwrite( header, 1, sizeof( header ), write_to ) !=
+                 sizeof( header ) ||
+             fflush( write_to ) == EOF ) {
+            return -1;
+        }
+    }
 
-    if ( init_shared_var( (void **)&journal->message_incr, sizeof( int ),
-                          JOURNAL_INCREMENTER_NAME ) == -1 ) {
+    if ( init_shared_var( arena, (void **)&journal->message_incr,
+                          JOURNAL_COUNTER_SIZE ) == -1 ) {
         return -1;
     }
     ( *journal->message_incr ) = 1;
 
-    if ( init_semaphore( &journal->lock, 1, JOURNAL_NAME ) == -1 ) {
-        destroy_shared_var( (void **)&journal->message_incr, sizeof( int ),
-                            JOURNAL_INCREMENTER_NAME );
+    if ( init_semaphore( arena, &journal->lock, 1 ) == -1 ) {
         return -1;
     }
 
-    return 0;
+    if ( mode != JOURNAL_ASYNC ) {
+        return 0;
+    }
+
+    if ( init_shared_var( arena, (void **)&journal->ring,
+                          sizeof( journal_ring_t ) ) == -1 ) {
+        return -1;
+    }
+    if ( init_semaphore( arena, &journal->ring_free, JOURNAL_RING_SIZE ) ==
+         -1 ) {
+        return -1;
+    }
+    if ( init_semaphore( arena, &journal->ring_published, 0 ) == -1 ) {
+        return -1;
+    }
+
+    return start_writer( journal );
 }
 
 void destroy_journal( journal_t *journal ) {
@@ -39,85 +126,509 @@ void destroy_journal( journal_t *journal ) {
         return;
     }
 
-    destroy_shared_var( (void **)&journal->message_incr, sizeof( int ),
-                        JOURNAL_INCREMENTER_NAME );
-    destroy_semaphore( &journal->lock, JOURNAL_NAME );
+    if ( journal->mode == JOURNAL_ASYNC && journal->ring != NULL ) {
+        __atomic_store_n( &journal->ring->closing, 1, __ATOMIC_RELEASE );
+        journal_bus( journal, 0, JOURNAL_SHUTDOWN );
+
+        if ( journal->writer_is_thread ) {
+            pthread_join( journal->writer_thread, NULL );
+        } else {
+            waitpid( journal->writer_pid, NULL, 0 );
+        }
+
+        destroy_semaphore( &journal->ring_free );
+        destroy_semaphore( &journal->ring_published );
+    }
+
+    if ( journal->mode == JOURNAL_BUFFERED ) {
+        (void)fflush( journal->write_to );
+    }
+
+    if ( journal->mode == JOURNAL_ATOMIC ) {
+        order_entries( journal );
+    }
+
+    destroy_semaphore( &journal->lock );
 }
 
-void journal_bus( journal_t *journal, char *message ) {
-    sem_wait( journal->lock );
+void abort_journal( journal_t *journal ) {
+    if ( journal == NULL || journal->mode != JOURNAL_ASYNC ||
+         journal->ring == NULL || journal->writer_is_thread ) {
+        return;
+    }
+
+    // Already reaped if it exited on its own
+    if ( journal->writer_pid > 0 ) {
+        kill( journal->writer_pid, SIGKILL );
+        waitpid( journal->writer_pid, NULL, 0 );
+    }
+    destroy_semaphore( &journal->ring_free );
+    destroy_semaphore( &journal->ring_published );
+    journal->ring = NULL;
+}
 
-    (void)fprintf( journal->write_to, "%i: BUS: %s\n", *journal->message_incr,
-             message );
-    ( *journal->message_incr )++;
+static int start_writer( journal_t *journal ) {
+    if ( journal->writer_is_thread ) {
+        if ( pthread_create( &journal->writer_thread, NULL, writer_thread,
+                             journal ) != 0 ) {
+            return -1;
+        }
+        return 0;
+    }
+
+    journal->writer_pid = fork_dependent_child();
+    if ( journal->writer_pid < 0 ) {
+        return -1;
+    }
+    if ( journal->writer_pid == 0 ) {
+        drain_ring( journal );
+        // Do not flush stdio buffers inherited from the parent
+        _exit( EXIT_SUCCESS );
+    }
+    return 0;
+}
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+static void *writer_thread( void *arg ) {
+    drain_ring( arg );
+    return NULL;
 }
 
-void journal_bus_arrived( journal_t *journal, int stop_id ) {
-    sem_wait( journal->lock );
+int journal_format_text( char *line, size_t size, journal_record_t *record ) {
+    int number = (int)record->number;
+    int stop_id = record->stop_id;
+
+    if ( record->actor == JOURNAL_ACTOR_BUS ) {
+        // Skibuses of a fleet may be labelled by their numbers
+        char bus[ JOURNAL_BUS_LABEL_SIZE ] = "BUS";
+        if ( record->actor_id != 0 ) {
+            (void)snprintf( bus, sizeof( bus ), "BUS %u", record->actor_id );
+        }
 
-    (void)fprintf( journal->write_to, "%i: BUS: arrived to %i\n",
-             *journal->message_incr, stop_id );
-    ( *journal->message_incr )++;
+        switch ( record->event ) {
+            case JOURNAL_STARTED:
+                return snprintf( line, size, "%i: %s: started\n", number,
+                                 bus );
+            case JOURNAL_ARRIVED_TO_STOP:
+                return snprintf( line, size, "%i: %s: arrived to %i\n",
+                                 number, bus, stop_id );
+            case JOURNAL_LEAVING_STOP:
+                return snprintf( line, size, "%i: %s: leaving %i\n", number,
+                                 bus, stop_id );
+            case JOURNAL_ARRIVED_TO_FINAL:
+                return snprintf( line, size, "%i: %s: arrived to final\n",
+                                 number, bus );
+            case JOURNAL_LEAVING_FINAL:
+                return snprintf( line, size, "%i: %s: leaving final\n",
+                                 number, bus );
+            case JOURNAL_FINISH:
+                return snprintf( line, size, "%i: %s: finish\n", number, bus );
+            default:
+                return 0;
+        }
+    }
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+    int skier_id = (int)record->actor_id;
+    switch ( record->event ) {
+        case JOURNAL_STARTED:
+            return snprintf( line, size, "%i: L %i: started\n", number,
+                             skier_id );
+        case JOURNAL_ARRIVED_TO_STOP:
+            return snprintf( line, size, "%i: L %i: arrived to %i\n", number,
+                             skier_id, stop_id );
+        case JOURNAL_BOARDING:
+            return snprintf( line, size, "%i: L %i: boarding\n", number,
+                             skier_id );
+        case JOURNAL_GOING_TO_SKI:
+            return snprintf( line, size, "%i: L %i: going to ski\n", number,
+                             skier_id );
+        default:
+            return 0;
+    }
 }
 
-void journal_bus_leaving( journal_t *journal, int stop_id ) {
-    sem_wait( journal->lock );
+static void put_le( unsigned char *bytes, uint64_t value, int size ) {
+    for ( int i = 0; i < size; i++ ) {
+        bytes[ i ] = (unsigned char)( value >> ( 8 * i ) );
+    }
+}
 
-    (void)fprintf( journal->write_to, "%i: BUS: leaving %i\n", *journal->message_incr,
-             stop_id );
-    ( *journal->message_incr )++;
+static uint64_t get_le( const unsigned char *bytes, int size ) {
+    uint64_t value = 0;
+    for ( int i = 0; i < size; i++ ) {
+        value |= (uint64_t)bytes[ i ] << ( 8 * i );
+    }
+    return value;
+}
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+static int binary_record_size( journal_format_t format ) {
+    if ( format == JOURNAL_BINARY_TIMESTAMPED ) {
+        return JOURNAL_BINARY_MAX_RECORD_SIZE;
+    }
+    return JOURNAL_BINARY_RECORD_SIZE;
 }
 
-void journal_skier( journal_t *journal, int skier_id, char *message ) {
-    sem_wait( journal->lock );
+static void encode_binary_header( unsigned char *header,
+                                  journal_format_t format ) {
+    memcpy( header, JOURNAL_BINARY_MAGIC, 4 );
+    header[ 4 ] = JOURNAL_BINARY_VERSION;
+    header[ 5 ] = format == JOURNAL_BINARY_TIMESTAMPED
+                      ? JOURNAL_BINARY_FLAG_TIMESTAMPS
+                      : 0;
+    put_le( header + 6, (uint64_t)binary_record_size( format ), 2 );
+}
 
-    (void)fprintf( journal->write_to, "%i: L %i: %s\n", *journal->message_incr,
-             skier_id, message );
-    ( *journal->message_incr )++;
+int journal_check_binary_header( const unsigned char *header ) {
+    if ( memcmp( header, JOURNAL_BINARY_MAGIC, 4 ) != 0 ||
+         header[ 4 ] != JOURNAL_BINARY_VERSION ) {
+        return -1;
+    }
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+    int record_size = (int)get_le( header + 6, 2 );
+    int expected_size = ( header[ 5 ] & JOURNAL_BINARY_FLAG_TIMESTAMPS )
+                            ? JOURNAL_BINARY_MAX_RECORD_SIZE
+                            : JOURNAL_BINARY_RECORD_SIZE;
+    if ( record_size != expected_size ) {
+        return -1;
+    }
+    return record_size;
 }
 
-void journal_skier_arrived_to_stop( journal_t *journal, int skier_id,
-                                    int stop_id ) {
-    sem_wait( journal->lock );
+static int encode_binary( unsigned char *bytes, journal_record_t *record,
+                          journal_format_t format ) {
+    put_le( bytes, record->number, 4 );
+    bytes[ 4 ] = (unsigned char)( record->actor << 7 | record->event );
+    put_le( bytes + 5, record->actor_id, 3 );
+    put_le( bytes + 8, record->stop_id, 2 );
+    if ( format == JOURNAL_BINARY_TIMESTAMPED ) {
+        put_le( bytes + JOURNAL_BINARY_RECORD_SIZE,
+                record->timestamp_ns / 1000, JOURNAL_BINARY_TIMESTAMP_SIZE );
+    }
+    return binary_record_size( format );
+}
 
-    (void)fprintf( journal->write_to, "%i: L %i: arrived to %i\n",
-             *journal->message_incr, skier_id, stop_id );
-    ( *journal->message_incr )++;
+void journal_decode_binary( const unsigned char *bytes, int record_size,
+                            journal_record_t *record ) {
+    record->number = (uint32_t)get_le( bytes, 4 );
+    record->actor = bytes[ 4 ] >> 7;
+    record->event = bytes[ 4 ] & 0x7f;
+    record->actor_id = (uint32_t)get_le( bytes + 5, 3 );
+    record->stop_id = (uint16_t)get_le( bytes + 8, 2 );
+    record->timestamp_ns = 0;
+    if ( record_size == JOURNAL_BINARY_MAX_RECORD_SIZE ) {
+        record->timestamp_ns =
+            get_le( bytes + JOURNAL_BINARY_RECORD_SIZE,
+                    JOURNAL_BINARY_TIMESTAMP_SIZE ) *
+            1000;
+    }
+}
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+/// @brief Encode a record in the format of the journal.
+/// @return Length of the encoded record.
+static int encode_record( journal_t *journal, char *buffer, size_t size,
+                          journal_record_t *record ) {
+    if ( journal->format != JOURNAL_TEXT ) {
+        return encode_binary( (unsigned char *)buffer, record,
+                              journal->format );
+    }
+    return journal_format_text( buffer, size, record );
 }
 
-void journal_skier_boarding( journal_t *journal, int skier_id ) {
-    sem_wait( journal->lock );
+static void write_all( int fd, char *buffer, size_t length ) {
+    while ( length > 0 ) {
+        ssize_t written = write( fd, buffer, length );
+        if ( written <= 0 ) {
+            return;
+        }
+        buffer += written;
+        length -= (size_t)written;
+    }
+}
+
+/// @brief Read `length` bytes at `offset`.
+/// @return -1 if not all of them could be read.
+static int read_all_at( int fd, char *buffer, size_t length, off_t offset ) {
+    while ( length > 0 ) {
+        ssize_t was_read = pread( fd, buffer, length, offset );
+        if ( was_read <= 0 ) {
+            return -1;
+        }
+        buffer += was_read;
+        length -= (size_t)was_read;
+        offset += was_read;
+    }
+    return 0;
+}
+
+/// @brief Find where every entry of an unordered journal starts, by its
+/// number, and how long it is.
+/// @return -1 if the entries are not numbered 1 to `entries` exactly once.
+static int index_entries( journal_t *journal, char *data, size_t size,
+                          int entries, size_t *starts, size_t *lengths ) {
+    int record_size = journal->format == JOURNAL_TEXT
+                          ? 0
+                          : binary_record_size( journal->format );
+    size_t offset = 0;
+    for ( int i = 0; i < entries; i++ ) {
+        if ( offset >= size ) {
+            return -1;
+        }
 
-    (void)fprintf( journal->write_to, "%i: L %i: boarding\n", *journal->message_incr,
-             skier_id );
-    ( *journal->message_incr )++;
+        char *entry = data + offset;
+        size_t length = 0;
+        long number = 0;
+        if ( record_size > 0 ) {
+            length = (size_t)record_size;
+            if ( length > size - offset ) {
+                return -1;
+            }
+            number = (long)get_le( (unsigned char *)entry, 4 );
+        } else {
+            char *end = memchr( entry, '\n', size - offset );
+            if ( end == NULL ) {
+                return -1;
+            }
+            length = (size_t)( end - entry ) + 1;
+            number = strtol( entry, NULL, DECIMAL_BASE );
+        }
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
+        if ( number < 1 || number > entries ||
+             lengths[ number - 1 ] != 0 ) {
+            return -1;
+        }
+        starts[ number - 1 ] = offset;
+        lengths[ number - 1 ] = length;
+        offset += length;
+    }
+    return offset == size ? 0 : -1;
 }
 
-void journal_skier_going_to_ski( journal_t *journal, int skier_id ) {
-    sem_wait( journal->lock );
+/// @brief Rewrite the entries of a JOURNAL_ATOMIC journal in the order of
+/// their numbers. Writers append them in the order they get to write(), so
+/// the run does not wait for the order, it is restored once at the end. A
+/// journal that is not a readable regular file, or that misses entries of
+/// writers that were killed, is left as it is.
+static void order_entries( journal_t *journal ) {
+    int fd = journal->write_to_fd;
+    struct stat status;
+    if ( fstat( fd, &status ) == -1 || !S_ISREG( status.st_mode ) ) {
+        return;
+    }
+    off_t start = journal->format == JOURNAL_TEXT ? 0
+                                                  : JOURNAL_BINARY_HEADER_SIZE;
+    int entries = *journal->message_incr - 1;
+    if ( entries == 0 || status.st_size <= start ) {
+        return;
+    }
+
+    size_t size = (size_t)( status.st_size - start );
+    char *unordered = malloc( size );
+    char *ordered = malloc( size );
+    size_t *starts = malloc( sizeof( size_t ) * (size_t)entries );
+    size_t *lengths = calloc( (size_t)entries, sizeof( size_t ) );
+    if ( unordered != NULL && ordered != NULL && starts != NULL &&
+         lengths != NULL && read_all_at( fd, unordered, size, start ) == 0 &&
+         index_entries( journal, unordered, size, entries, starts,
+                        lengths ) == 0 ) {
+        size_t offset = 0;
+        for ( int i = 0; i < entries; i++ ) {
+            memcpy( ordered + offset, unordered + starts[ i ], lengths[ i ] );
+            offset += lengths[ i ];
+        }
+
+        // Writes of an O_APPEND descriptor ignore the offset
+        int flags = fcntl( fd, F_GETFL );
+        if ( flags != -1 &&
+             fcntl( fd, F_SETFL, flags & ~O_APPEND ) != -1 &&
+             lseek( fd, start, SEEK_SET ) != -1 ) {
+            write_all( fd, ordered, size );
+        }
+    }
+
+    free( unordered );
+    free( ordered );
+    free( starts );
+    free( lengths );
+}
+
+static long elapsed_ns( struct timespec *since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000000L +
+           ( now.tv_nsec - since->tv_nsec );
+}
+
+/// @brief Wait until the record in a reserved slot is published.
+/// @return 0 once published. -1 if the slot was abandoned.
+static int wait_for_slot( journal_ring_t *ring, journal_slot_t *slot,
+                          uint32_t number ) {
+    struct timespec closing_since = { 0, 0 };
+    while ( __atomic_load_n( &slot->published, __ATOMIC_ACQUIRE ) != number ) {
+        // The producer has taken the number and is filling the record
+        sched_yield();
+
+        if ( !__atomic_load_n( &ring->closing, __ATOMIC_ACQUIRE ) ) {
+            continue;
+        }
+        if ( closing_since.tv_sec == 0 && closing_since.tv_nsec == 0 ) {
+            clock_gettime( CLOCK_MONOTONIC, &closing_since );
+        } else if ( elapsed_ns( &closing_since ) > JOURNAL_ABANDON_SLOT_NS ) {
+            // Producer was killed after reserving the slot
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/// @brief Body of the asynchronous writer. Consumes records in the order of
+/// their numbers until the shutdown record.
+static void drain_ring( journal_t *journal ) {
+    journal_ring_t *ring = journal->ring;
+    char *buffer = malloc( JOURNAL_WRITE_BATCH_SIZE + JOURNAL_LINE_MAX_SIZE );
+    if ( buffer == NULL ) {
+        return;
+    }
+    size_t buffered = 0;
+    uint32_t expected = 1;
+
+    bool running = true;
+    while ( running ) {
+        timed_sem_wait( journal->ring_published,
+                        SYNC_JOURNAL_RING_PUBLISHED );
+        // Consume everything available before writing
+        int available = 1;
+        while ( sem_trywait( journal->ring_published ) == 0 ) {
+            available++;
+        }
+
+        for ( int i = 0; i < available && running; i++ ) {
+            journal_slot_t *slot =
+                &ring->slots[ ( expected - 1 ) % JOURNAL_RING_SIZE ];
 
-    (void)fprintf( journal->write_to, "%i: L %i: going to ski\n",
-             *journal->message_incr, skier_id );
-    ( *journal->message_incr )++;
+            if ( wait_for_slot( ring, slot, expected ) == 0 ) {
+                journal_record_t record = slot->record;
+                if ( record.event == JOURNAL_SHUTDOWN ) {
+                    running = false;
+                } else {
+                    buffered += (size_t)encode_record(
+                        journal, buffer + buffered, JOURNAL_LINE_MAX_SIZE,
+                        &record );
+                }
+            } else {
+                // Wait for the same token again
+                i--;
+            }
+            expected++;
+            sem_post( journal->ring_free );
 
-    (void)fflush( journal->write_to );
-    sem_post( journal->lock );
-}
\ No newline at end of file
+            if ( buffered >= JOURNAL_WRITE_BATCH_SIZE ) {
+                write_all( journal->write_to_fd, buffer, buffered );
+                buffered = 0;
+            }
+        }
+
+        write_all( journal->write_to_fd, buffer, buffered );
+        buffered = 0;
+    }
+
+    free( buffer );
+}
+
+/// @brief Write a numbered entry into the journal.
+static void journal_entry( journal_t *journal, journal_actor_t actor,
+                           int actor_id, journal_event_t event, int stop_id ) {
+    journal_record_t record;
+    record.actor = (uint8_t)actor;
+    record.actor_id = (uint32_t)actor_id;
+    record.event = (uint8_t)event;
+    record.stop_id = (uint16_t)stop_id;
+    record.timestamp_ns = 0;
+    if ( journal->format == JOURNAL_BINARY_TIMESTAMPED ) {
+        record.timestamp_ns = journal->clock_ns != NULL
+                                  ? *journal->clock_ns
+                                  : (uint64_t)elapsed_ns( &journal->opened_at );
+    }
+
+    char line[ JOURNAL_LINE_MAX_SIZE ];
+
+    switch ( journal->mode ) {
+        case JOURNAL_LOCKED: {
+            timed_sem_wait( journal->lock, SYNC_JOURNAL_LOCK );
+
+            record.number = (uint32_t)*journal->message_incr;
+            int length =
+                encode_record( journal, line, sizeof( line ), &record );
+            (void)fwrite( line, 1, (size_t)length, journal->write_to );
+            ( *journal->message_incr )++;
+
+            (void)fflush( journal->write_to );
+            sem_post( journal->lock );
+            break;
+        }
+        case JOURNAL_ATOMIC: {
+            record.number = (uint32_t)__atomic_fetch_add(
+                journal->message_incr, 1, __ATOMIC_RELAXED );
+            int length =
+                encode_record( journal, line, sizeof( line ), &record );
+
+            // A single write() on an O_APPEND file lands as a whole, the
+            // entries are put in order once the journal is destroyed
+            write_all( journal->write_to_fd, line, (size_t)length );
+            break;
+        }
+        case JOURNAL_ASYNC: {
+            // Reserve a slot, fill it and publish it
+            timed_sem_wait( journal->ring_free, SYNC_JOURNAL_RING_FREE );
+            record.number = (uint32_t)__atomic_fetch_add(
+                journal->message_incr, 1, __ATOMIC_RELAXED );
+            journal_slot_t *slot =
+                &journal->ring->slots[ ( record.number - 1 ) %
+                                       JOURNAL_RING_SIZE ];
+            slot->record = record;
+            __atomic_store_n( &slot->published, record.number,
+                              __ATOMIC_RELEASE );
+            sem_post( journal->ring_published );
+            break;
+        }
+        case JOURNAL_BUFFERED: {
+            record.number = (uint32_t)( *journal->message_incr )++;
+            int length =
+                encode_record( journal, line, sizeof( line ), &record );
+            (void)fwrite( line, 1, (size_t)length, journal->write_to );
+            break;
+        }
+    }
+}
+
+void journal_bus( journal_t *journal, int bus_id, journal_event_t event ) {
+    journal_entry( journal, JOURNAL_ACTOR_BUS, bus_id, event, 0 );
+}
+
+void journal_bus_arrived( journal_t *journal, int bus_id, int stop_id ) {
+    journal_entry( journal, JOURNAL_ACTOR_BUS, bus_id, JOURNAL_ARRIVED_TO_STOP,
+                   stop_id );
+}
+
+void journal_bus_leaving( journal_t *journal, int bus_id, int stop_id ) {
+    journal_entry( journal, JOURNAL_ACTOR_BUS, bus_id, JOURNAL_LEAVING_STOP,
+                   stop_id );
+}
+
+void journal_skier( journal_t *journal, int skier_id, journal_event_t event ) {
+    journal_entry( journal, JOURNAL_ACTOR_SKIER, skier_id, event, 0 );
+}
+
+void journal_skier_arrived_to_stop( journal_t *journal, int skier_id,
+                                    int stop_id ) {
+    journal_entry( journal, JOURNAL_ACTOR_SKIER, skier_id,
+                   JOURNAL_ARRIVED_TO_STOP, stop_id );
+}
+
+void journal_skier_boarding( journal_t *journal, int skier_id ) {
+    journal_entry( journal, JOURNAL_ACTOR_SKIER, skier_id, JOURNAL_BOARDING,
+                   0 );
+}
+
+void journal_skier_going_to_ski( journal_t *journal, int skier_id ) {
+    journal_entry( journal, JOURNAL_ACTOR_SKIER, skier_id,
+                   JOURNAL_GOING_TO_SKI, 0 );
+}
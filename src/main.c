@@ -4,14 +4,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "../include/metrics_server.h"
+#include "../include/monte_carlo.h"
+#include "../include/random.h"
+#include "../include/route.h"
+#include "../include/sharing.h"
 #include "../include/simulation.h"
 #include "../include/ski_resort.h"
 
 #define OUTPUT_FILENAME "proj2.out"
+#define BINARY_OUTPUT_FILENAME "proj2.bin"
+#define MAX_BUSES_TEXT "100"
+#define VIRTUAL_MAX_SKIERS_TEXT "10000000"
+#define VIRTUAL_MAX_STOPS_TEXT "1000"
+#define MAX_RUNS_TEXT "10000"
+#define MAX_ROUTE_STOPS_TEXT "10000"
 
 static const char HELP_TEXT[] =
-    "Usage: ./proj2 L Z K TL TB\n"
+    "Usage: ./proj2 [OPTIONS] L Z K TL TB\n"
     "\n"
     "Arguments:\n"
     "- L: number of skiers, L<20000\n"
@@ -20,58 +32,298 @@ static const char HELP_TEXT[] =
     "- TL: Maximum time in microseconds a skier waits \n"
     "      before arriving at a stop, 0<=TL<=10000\n"
     "- TB: Maximum time it takes for the bus to travel \n"
-    "      between two stops, 0<=TB<=1000\n";
+    "      between two stops, 0<=TB<=1000\n"
+    "\n"
+    "Options:\n"
+    "- --threads: run the skibus and skiers as threads of a single\n"
+    "      process instead of forking a process for each of them\n"
+    "- --workers[=N]: run skiers in N worker processes, each hosting\n"
+    "      many skiers, instead of a process per skier. Defaults to the\n"
+    "      number of online CPUs\n"
+    "- --virtual-time: simulate in virtual time by a single thread.\n"
+    "      Walks and rides take no real time, so L<=" VIRTUAL_MAX_SKIERS_TEXT
+    "\n"
+    "      and Z<=" VIRTUAL_MAX_STOPS_TEXT
+    " are allowed. --journal is ignored\n"
+    "- --buses=N: size of the skibus fleet, 1<=N<=" MAX_BUSES_TEXT
+    " (default 1)\n"
+    "- --label-buses: journal entries of skibuses carry their numbers,\n"
+    "      \"BUS 2: started\"\n"
+    "- --timing: print the time from the start to the last \"finish\"\n"
+    "      entry and the number of journal entries to stderr\n"
+    "- --skip-empty-stops: skibuses drive past stops nobody waits at nor\n"
+    "      walks to, and a full skibus drives straight to the final stop.\n"
+    "      A ride past skipped stops takes as long as their segments\n"
+    "      together\n"
+    "- --route=FILE: ride times of the segments of the route, a line\n"
+    "      \"<shortest> <longest>\" in microseconds per stop, the first\n"
+    "      leading from the final stop. Lines starting with '#' are\n"
+    "      skipped. Z must equal the number of stops in FILE (at most\n"
+    "      " MAX_ROUTE_STOPS_TEXT ", in every mode); TB is ignored\n"
+    "- --metrics: print p50, p95 and p99 of how long skiers walked,\n"
+    "      waited at every stop and rode, the occupancy of skibuses\n"
+    "      leaving every stop and the trips to stderr\n"
+    "- --metrics-socket=PATH: serve live counters on a Unix socket at\n"
+    "      PATH while the simulation runs. Every connection gets the\n"
+    "      skiers started, waiting, walking, boarded and at the resort,\n"
+    "      the position and load of every skibus, the journal entries\n"
+    "      and, built by make prof, the waits on locks. Ignored with\n"
+    "      --virtual-time and --runs\n"
+    "- --seed=N: seed of the random walk times, ride times and stops.\n"
+    "      A seed gives the same skiers and rides in every mode\n"
+    "- --huge-pages: back the shared memory by huge pages if available\n"
+    "- --journal=MODE: how journal entries are written\n"
+    "      locked: one entry at a time under a shared lock (default)\n"
+    "      atomic: entries are numbered by an atomic counter and written\n"
+    "              by a single write(), possibly out of order. The\n"
+    "              journal is put in order once the simulation ends\n"
+    "      async: entries are queued in shared memory and written in\n"
+    "             batches by a dedicated writer\n"
+    "- --journal-format=FORMAT: how journal entries are encoded\n"
+    "      text: lines written to " OUTPUT_FILENAME " (default)\n"
+    "      binary: fixed-width records written to " BINARY_OUTPUT_FILENAME
+    ",\n"
+    "              decoded to text by proj2-decode\n"
+    "      binary-timestamps: binary records with the time of every\n"
+    "                         entry in microseconds\n"
+    "- --runs=N: run N independent simulations with seeds derived from\n"
+    "      --seed, 1<=N<=" MAX_RUNS_TEXT ". Journals are discarded, the\n"
+    "      mean and percentiles of the time to finish, trips, occupancy\n"
+    "      and the wait at every stop are printed instead. --timing and\n"
+    "      --metrics are ignored\n"
+    "- --jobs=N: how many of the --runs run at once. Defaults to the\n"
+    "      number of online CPUs\n"
+    "- --shm-name=NAME: name of the shared memory, \"/name\". Defaults to\n"
+    "      \"/" SHM_ARENA_BASE_NAME ".<pid>.<nonce>\", unique to the instance.\n"
+    "      Fails if the name is taken. Shared memory of instances that\n"
+    "      are gone is removed on every start\n";
 
-enum { ARG_COUNT = 6 };
+enum { ARG_COUNT = 5 };
 
 // CLI arguments ordering
 enum {
-    SKIERS = 1,
-    STOPS = 2,
-    BUS_CAPACITY = 3,
-    WALK_TO_STOP = 4,
-    RIDE_TO_STOP = 5
+    SKIERS = 0,
+    STOPS = 1,
+    BUS_CAPACITY = 2,
+    WALK_TO_STOP = 3,
+    RIDE_TO_STOP = 4
 };
 
 // Program limitations
 const int MAX_SKIERS = 19999;
 const int MAX_STOPS = 10;
+// Limits of a simulation in virtual time
+const int VIRTUAL_MAX_SKIERS = 10000000;
+const int VIRTUAL_MAX_STOPS = 1000;
 const int MIN_BUS_CAPACITY = 10;
 const int MAX_BUS_CAPACITY = 100;
+const int MAX_BUSES = 100;
 const int MAX_WALK_TO_STOP_TIME = 10000;
 const int MAX_RIDE_TO_STOP_TIME = 1000;
+const int MAX_RUNS = 10000;
+// Limit of a route read from a file
+const int MAX_ROUTE_STOPS = 10000;
+const int MAX_JOBS = 1024;
 
 /// @brief Enforce that number is within an allowed range. If number is not
 /// within range, prints an error message and exits the program.
 void within_min_max( int val, int min, int max, char *val_name );
 
+/// @brief Run the simulation, or `runs` of them if positive, with the output
+/// the mode writes.
+/// @return Exit code of the program.
+static int run( arguments_t *args, int runs, int jobs );
+
+/// @brief Convert a string to an unsigned 64-bit seed. If string is not
+/// convertible, print an error message and exit the program.
+uint64_t arg_to_seed_or_exit( char *arg );
+
 /// @brief Convert a string to integer. If string is not converible, print an
 /// error message and exit the program.
 int arg_to_int_or_exit( char *arg );
 
 int main( int argc, char *argv[] ) {
+    arguments_t args;
+    args.execution_mode = EXEC_PROCESSES;
+    args.workers_amount = 0;
+    args.huge_pages = false;
+    args.journal_mode = JOURNAL_LOCKED;
+    args.journal_format = JOURNAL_TEXT;
+    args.seed = random_seed();
+    args.buses_amount = 1;
+    args.label_buses = false;
+    args.report_timing = false;
+    args.print_metrics = false;
+    args.skip_empty_stops = false;
+    args.shm_name = NULL;
+    args.metrics_socket = NULL;
+    args.report = NULL;
+    // Uniform route of Z stops up to TB long if not given
+    char *route_path = NULL;
+    // Monte Carlo mode if positive
+    int runs = 0;
+    int jobs = 0;
+
+    // Options may be mixed with positional arguments
+    char *positional[ ARG_COUNT ];
+    int positional_count = 0;
     for ( int i = 1; i < argc; i++ ) {
         if ( strcmp( argv[ i ], "--help" ) == 0 ||
              strcmp( argv[ i ], "-h" ) == 0 ) {
             (void)printf( HELP_TEXT );
             return EXIT_SUCCESS;
         }
+        if ( strcmp( argv[ i ], "--threads" ) == 0 ) {
+            args.execution_mode = EXEC_THREADS;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--workers" ) == 0 ) {
+            args.execution_mode = EXEC_WORKERS;
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--workers=", strlen( "--workers=" ) ) ==
+             0 ) {
+            args.execution_mode = EXEC_WORKERS;
+            args.workers_amount =
+                arg_to_int_or_exit( argv[ i ] + strlen( "--workers=" ) );
+            within_min_max( args.workers_amount, 1, MAX_SKIERS, "workers" );
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--virtual-time" ) == 0 ) {
+            args.execution_mode = EXEC_VIRTUAL_TIME;
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--buses=", strlen( "--buses=" ) ) == 0 ) {
+            args.buses_amount =
+                arg_to_int_or_exit( argv[ i ] + strlen( "--buses=" ) );
+            within_min_max( args.buses_amount, 1, MAX_BUSES, "buses" );
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--timing" ) == 0 ) {
+            args.report_timing = true;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--skip-empty-stops" ) == 0 ) {
+            args.skip_empty_stops = true;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--metrics" ) == 0 ) {
+            args.print_metrics = true;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--label-buses" ) == 0 ) {
+            args.label_buses = true;
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--seed=", strlen( "--seed=" ) ) == 0 ) {
+            args.seed = arg_to_seed_or_exit( argv[ i ] + strlen( "--seed=" ) );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--runs=", strlen( "--runs=" ) ) == 0 ) {
+            runs = arg_to_int_or_exit( argv[ i ] + strlen( "--runs=" ) );
+            within_min_max( runs, 1, MAX_RUNS, "runs" );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--jobs=", strlen( "--jobs=" ) ) == 0 ) {
+            jobs = arg_to_int_or_exit( argv[ i ] + strlen( "--jobs=" ) );
+            within_min_max( jobs, 1, MAX_JOBS, "jobs" );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--shm-name=", strlen( "--shm-name=" ) ) ==
+             0 ) {
+            args.shm_name = argv[ i ] + strlen( "--shm-name=" );
+            // A leading slash and no other, as portable shm_open() wants
+            size_t length = strlen( args.shm_name );
+            if ( args.shm_name[ 0 ] != '/' || length < 2 ||
+                 length >= SHARED_ARENA_NAME_MAX_SIZE ||
+                 strchr( args.shm_name + 1, '/' ) != NULL ) {
+                (void)fprintf( stderr,
+                               "--shm-name must be \"/name\" shorter than "
+                               "%i characters\n",
+                               SHARED_ARENA_NAME_MAX_SIZE );
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--metrics-socket=",
+                      strlen( "--metrics-socket=" ) ) == 0 ) {
+            args.metrics_socket = argv[ i ] + strlen( "--metrics-socket=" );
+            size_t length = strlen( args.metrics_socket );
+            if ( length == 0 || length >= METRICS_SOCKET_PATH_MAX_SIZE ) {
+                (void)fprintf( stderr,
+                               "--metrics-socket must be a path shorter than "
+                               "%i characters\n",
+                               METRICS_SOCKET_PATH_MAX_SIZE );
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--route=", strlen( "--route=" ) ) == 0 ) {
+            route_path = argv[ i ] + strlen( "--route=" );
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--huge-pages" ) == 0 ) {
+            args.huge_pages = true;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal=locked" ) == 0 ) {
+            args.journal_mode = JOURNAL_LOCKED;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal=atomic" ) == 0 ) {
+            args.journal_mode = JOURNAL_ATOMIC;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal=async" ) == 0 ) {
+            args.journal_mode = JOURNAL_ASYNC;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal-format=text" ) == 0 ) {
+            args.journal_format = JOURNAL_TEXT;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal-format=binary" ) == 0 ) {
+            args.journal_format = JOURNAL_BINARY;
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--journal-format=binary-timestamps" ) ==
+             0 ) {
+            args.journal_format = JOURNAL_BINARY_TIMESTAMPED;
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--", 2 ) == 0 ) {
+            (void)fprintf( stderr, "unknown option %s\n", argv[ i ] );
+            return EXIT_FAILURE;
+        }
+
+        if ( positional_count == ARG_COUNT ) {
+            (void)fprintf( stderr, "too many arguments\n" );
+            return EXIT_FAILURE;
+        }
+        positional[ positional_count++ ] = argv[ i ];
     }
 
-    arguments_t args;
-    if ( argc != ARG_COUNT ) {
+    if ( positional_count != ARG_COUNT ) {
         (void)fprintf( stderr, "not enough arguments\n" );
         return EXIT_FAILURE;
     }
 
-    args.skiers_amount = arg_to_int_or_exit( argv[ SKIERS ] );
-    args.stops_amount = arg_to_int_or_exit( argv[ STOPS ] );
-    args.bus_capacity = arg_to_int_or_exit( argv[ BUS_CAPACITY ] );
-    args.max_walk_to_stop_time = arg_to_int_or_exit( argv[ WALK_TO_STOP ] );
-    args.max_ride_to_stop_time = arg_to_int_or_exit( argv[ RIDE_TO_STOP ] );
+    args.skiers_amount = arg_to_int_or_exit( positional[ SKIERS ] );
+    args.stops_amount = arg_to_int_or_exit( positional[ STOPS ] );
+    args.bus_capacity = arg_to_int_or_exit( positional[ BUS_CAPACITY ] );
+    args.max_walk_to_stop_time =
+        arg_to_int_or_exit( positional[ WALK_TO_STOP ] );
+    args.max_ride_to_stop_time =
+        arg_to_int_or_exit( positional[ RIDE_TO_STOP ] );
 
-    within_min_max( args.skiers_amount, 0, MAX_SKIERS, "L" );
-    within_min_max( args.stops_amount, 0, MAX_STOPS, "Z" );
+    bool virtual_time = args.execution_mode == EXEC_VIRTUAL_TIME;
+    int max_stops = virtual_time ? VIRTUAL_MAX_STOPS : MAX_STOPS;
+    if ( route_path != NULL ) {
+        max_stops = MAX_ROUTE_STOPS;
+    }
+    within_min_max( args.skiers_amount, 0,
+                    virtual_time ? VIRTUAL_MAX_SKIERS : MAX_SKIERS, "L" );
+    within_min_max( args.stops_amount, 1, max_stops, "Z" );
     within_min_max( args.bus_capacity, MIN_BUS_CAPACITY, MAX_BUS_CAPACITY,
                     "K" );
     within_min_max( args.max_walk_to_stop_time, 0, MAX_WALK_TO_STOP_TIME,
@@ -79,17 +331,71 @@ int main( int argc, char *argv[] ) {
     within_min_max( args.max_ride_to_stop_time, 0, MAX_RIDE_TO_STOP_TIME,
                     "TB" );
 
-    args.output = fopen( OUTPUT_FILENAME, "we" );
-    if ( args.output == NULL ) {
+    if ( args.execution_mode == EXEC_WORKERS ) {
+        if ( args.workers_amount == 0 ) {
+            long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+            args.workers_amount = cpus > 0 ? (int)cpus : 1;
+        }
+        // A worker without skiers would be useless
+        if ( args.workers_amount > args.skiers_amount ) {
+            args.workers_amount = args.skiers_amount;
+        }
+    }
+
+    route_t route;
+    if ( route_path != NULL ) {
+        if ( load_route( &route, route_path, MAX_ROUTE_STOPS,
+                         MAX_RIDE_TO_STOP_TIME ) == -1 ) {
+            return EXIT_FAILURE;
+        }
+        if ( route.stops_amount != args.stops_amount ) {
+            (void)fprintf( stderr, "route %s has %i stops, Z is %i\n",
+                           route_path, route.stops_amount,
+                           args.stops_amount );
+            destroy_route( &route );
+            return EXIT_FAILURE;
+        }
+    } else if ( init_uniform_route( &route, args.stops_amount,
+                                    args.max_ride_to_stop_time ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        return EXIT_FAILURE;
+    }
+    args.route = &route;
+
+    // Crashed instances cannot remove their shared memory themselves
+    (void)sweep_stale_shm( SHM_ARENA_BASE_NAME );
+
+    int exit_code = run( &args, runs, jobs );
+    destroy_route( &route );
+    return exit_code;
+}
+
+static int run( arguments_t *args, int runs, int jobs ) {
+    if ( runs > 0 ) {
+        if ( jobs == 0 ) {
+            long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+            jobs = cpus > 0 ? (int)cpus : 1;
+        }
+        return run_monte_carlo( args, runs, jobs ) == -1 ? EXIT_FAILURE
+                                                         : EXIT_SUCCESS;
+    }
+
+    // Readable too, a journal of --journal=atomic is put in order at the end
+    if ( args->journal_format != JOURNAL_TEXT ) {
+        args->output = fopen( BINARY_OUTPUT_FILENAME, "w+be" );
+    } else {
+        args->output = fopen( OUTPUT_FILENAME, "w+e" );
+    }
+    if ( args->output == NULL ) {
         (void)fprintf( stderr, "Failed to open an output file" );
         return EXIT_FAILURE;
     }
 
-    if ( run_simulation( &args ) == -1 ) {
-        (void)fclose( args.output );
+    if ( run_simulation( args ) == -1 ) {
+        (void)fclose( args->output );
         return EXIT_FAILURE;
     }
-    (void)fclose( args.output );
+    (void)fclose( args->output );
     return EXIT_SUCCESS;
 }
 
@@ -121,6 +427,22 @@ int arg_to_int_or_exit( char *arg ) {
     return (int)num_long;
 }
 
+uint64_t arg_to_seed_or_exit( char *arg ) {
+    char *endptr = NULL;
+
+    errno = 0;
+    unsigned long long seed = strtoull( arg, &endptr, DECIMAL_BASE );
+
+    // strtoull() silently negates negative numbers
+    if ( errno == ERANGE || endptr == arg || *endptr != '\0' ||
+         arg[ 0 ] == '-' ) {
+        (void)fprintf( stderr, "invalid seed\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    return (uint64_t)seed;
+}
+
 void within_min_max( int val, int min, int max, char *val_name ) {
     if ( min > val || val > max ) {
         (void)fprintf( stderr, "%s must be bigger than %i and lower than %i\n",
@@ -0,0 +1,302 @@
+#include "../include/metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../include/sharing.h"
+
+static int bucket_of( uint64_t ns ) {
+    if ( ns < METRICS_SUB_BUCKETS ) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll( ns );
+    int shift = exponent - METRICS_SUB_BUCKET_BITS;
+    int bucket = ( shift + 1 ) * METRICS_SUB_BUCKETS +
+                 (int)( ( ns >> shift ) & ( METRICS_SUB_BUCKETS - 1 ) );
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+/// @brief Middle of the durations a bucket counts.
+static uint64_t bucket_middle( int bucket ) {
+    if ( bucket < METRICS_SUB_BUCKETS ) {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / METRICS_SUB_BUCKETS - 1;
+    uint64_t lowest =
+        (uint64_t)( METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS )
+        << shift;
+    return lowest + ( ( 1ULL << shift ) >> 1 );
+}
+
+static void histogram_add( metrics_histogram_t *histogram, uint64_t ns ) {
+    __atomic_add_fetch( &histogram->buckets[ bucket_of( ns ) ], 1,
+                        __ATOMIC_RELAXED );
+
+    uint64_t max = __atomic_load_n( &histogram->max_ns, __ATOMIC_RELAXED );
+    while ( ns > max &&
+            !__atomic_compare_exchange_n( &histogram->max_ns, &max, ns, true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) ) {
+    }
+}
+
+static uint64_t histogram_count( metrics_histogram_t *histogram ) {
+    uint64_t count = 0;
+    for ( int i = 0; i < METRICS_BUCKETS; i++ ) {
+        count += __atomic_load_n( &histogram->buckets[ i ], __ATOMIC_RELAXED );
+    }
+    return count;
+}
+
+/// @brief Duration that `fraction` of the counted ones do not exceed.
+static uint64_t histogram_percentile( metrics_histogram_t *histogram,
+                                      uint64_t count, double fraction ) {
+    uint64_t max = __atomic_load_n( &histogram->max_ns, __ATOMIC_RELAXED );
+    uint64_t rank = (uint64_t)( fraction * (double)count );
+    if ( (double)rank < fraction * (double)count ) {
+        rank++;
+    }
+
+    uint64_t seen = 0;
+    for ( int i = 0; i < METRICS_BUCKETS; i++ ) {
+        seen += __atomic_load_n( &histogram->buckets[ i ], __ATOMIC_RELAXED );
+        if ( seen >= rank ) {
+            uint64_t middle = bucket_middle( i );
+            return middle < max ? middle : max;
+        }
+    }
+    return max;
+}
+
+size_t metrics_shared_size( int stops_amount ) {
+    return 5 * shared_object_size( sizeof( uint64_t ) ) +
+           shared_object_size( sizeof( stop_metrics_t ) *
+                               (size_t)stops_amount ) +
+           3 * shared_object_size( sizeof( metrics_histogram_t ) ) +
+           shared_object_size( sizeof( metrics_histogram_t ) *
+                               (size_t)stops_amount );
+}
+
+int init_metrics( resort_metrics_t *metrics, shared_arena_t *arena,
+                  int stops_amount, int bus_capacity ) {
+    metrics->stops_amount = stops_amount;
+    metrics->bus_capacity = bus_capacity;
+
+    // Every counter starts on a cache line of its own, so the skibuses
+    // counting trips do not share lines with skiers of the stops
+    size_t stops_size = sizeof( stop_metrics_t ) * (size_t)stops_amount;
+    size_t waits_size = sizeof( metrics_histogram_t ) * (size_t)stops_amount;
+    if ( init_shared_var( arena, (void **)&metrics->trips,
+                          sizeof( uint64_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->trips_load,
+                          sizeof( uint64_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->first_start_ns,
+                          sizeof( uint64_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->last_start_ns,
+                          sizeof( uint64_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->skiers_started,
+                          sizeof( uint64_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->stops, stops_size ) ==
+             -1 ||
+         init_shared_var( arena, (void **)&metrics->walk,
+                          sizeof( metrics_histogram_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->ride,
+                          sizeof( metrics_histogram_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->passes_waited,
+                          sizeof( metrics_histogram_t ) ) == -1 ||
+         init_shared_var( arena, (void **)&metrics->waits, waits_size ) ==
+             -1 ) {
+        return -1;
+    }
+    *metrics->first_start_ns = UINT64_MAX;
+    return 0;
+}
+
+uint64_t metrics_clock( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void metrics_add_start( resort_metrics_t *metrics, uint64_t now_ns ) {
+    uint64_t first =
+        __atomic_load_n( metrics->first_start_ns, __ATOMIC_RELAXED );
+    while ( now_ns < first &&
+            !__atomic_compare_exchange_n( metrics->first_start_ns, &first,
+                                          now_ns, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) ) {
+    }
+    uint64_t last = __atomic_load_n( metrics->last_start_ns, __ATOMIC_RELAXED );
+    while ( now_ns > last &&
+            !__atomic_compare_exchange_n( metrics->last_start_ns, &last,
+                                          now_ns, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) ) {
+    }
+}
+
+void metrics_add_skier_start( resort_metrics_t *metrics, uint64_t now_ns ) {
+    __atomic_add_fetch( metrics->skiers_started, 1, __ATOMIC_RELAXED );
+    metrics_add_start( metrics, now_ns );
+}
+
+uint64_t metrics_start_spread( resort_metrics_t *metrics ) {
+    uint64_t first =
+        __atomic_load_n( metrics->first_start_ns, __ATOMIC_RELAXED );
+    uint64_t last = __atomic_load_n( metrics->last_start_ns, __ATOMIC_RELAXED );
+    return last > first ? last - first : 0;
+}
+
+void metrics_add_walk( resort_metrics_t *metrics, uint64_t walk_ns ) {
+    histogram_add( metrics->walk, walk_ns );
+}
+
+void metrics_add_boarding( resort_metrics_t *metrics, int stop_idx,
+                           uint64_t wait_ns ) {
+    stop_metrics_t *stop = &metrics->stops[ stop_idx ];
+    __atomic_add_fetch( &stop->boarded, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &stop->wait_ns, wait_ns, __ATOMIC_RELAXED );
+    histogram_add( &metrics->waits[ stop_idx ], wait_ns );
+}
+
+void metrics_add_passes_waited( resort_metrics_t *metrics, uint32_t passes ) {
+    histogram_add( metrics->passes_waited, passes );
+}
+
+void metrics_add_ride( resort_metrics_t *metrics, uint64_t ride_ns ) {
+    histogram_add( metrics->ride, ride_ns );
+}
+
+void metrics_add_stop_visit( resort_metrics_t *metrics, int stop_idx,
+                             int passengers ) {
+    stop_metrics_t *stop = &metrics->stops[ stop_idx ];
+    __atomic_add_fetch( &stop->visits, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &stop->load, (uint64_t)passengers, __ATOMIC_RELAXED );
+}
+
+void metrics_add_stop_skip( resort_metrics_t *metrics, int stop_idx ) {
+    __atomic_add_fetch( &metrics->stops[ stop_idx ].skips, 1,
+                        __ATOMIC_RELAXED );
+}
+
+void metrics_add_trip( resort_metrics_t *metrics, int passengers ) {
+    __atomic_add_fetch( metrics->trips, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( metrics->trips_load, (uint64_t)passengers,
+                        __ATOMIC_RELAXED );
+}
+
+void fill_run_report( run_report_t *report, resort_metrics_t *metrics,
+                      long long finish_ns ) {
+    report->finish_ns = finish_ns;
+    report->start_spread_ns = metrics_start_spread( metrics );
+    report->trips = __atomic_load_n( metrics->trips, __ATOMIC_RELAXED );
+    report->max_passes_waited =
+        __atomic_load_n( &metrics->passes_waited->max_ns, __ATOMIC_RELAXED );
+    for ( int i = 0; i < metrics->stops_amount; i++ ) {
+        stop_metrics_t *stop = &metrics->stops[ i ];
+        report->stops[ i ].boarded =
+            __atomic_load_n( &stop->boarded, __ATOMIC_RELAXED );
+        report->stops[ i ].wait_ns =
+            __atomic_load_n( &stop->wait_ns, __ATOMIC_RELAXED );
+        report->stops[ i ].visits =
+            __atomic_load_n( &stop->visits, __ATOMIC_RELAXED );
+        report->stops[ i ].load =
+            __atomic_load_n( &stop->load, __ATOMIC_RELAXED );
+        report->stops[ i ].skips =
+            __atomic_load_n( &stop->skips, __ATOMIC_RELAXED );
+    }
+}
+
+/// @brief Print a row of the percentiles of a histogram in milliseconds.
+static void print_durations( FILE *out, const char *name,
+                             metrics_histogram_t *histogram ) {
+    uint64_t count = histogram_count( histogram );
+    if ( count == 0 ) {
+        (void)fprintf( out, "%-12s %10d\n", name, 0 );
+        return;
+    }
+    (void)fprintf(
+        out, "%-12s %10llu %10.3f %10.3f %10.3f %10.3f\n", name,
+        (unsigned long long)count,
+        (double)histogram_percentile( histogram, count, 0.5 ) / 1e6,
+        (double)histogram_percentile( histogram, count, 0.95 ) / 1e6,
+        (double)histogram_percentile( histogram, count, 0.99 ) / 1e6,
+        (double)__atomic_load_n( &histogram->max_ns, __ATOMIC_RELAXED ) /
+            1e6 );
+}
+
+/// @brief Passengers on board in percent of the capacity.
+static double occupancy( resort_metrics_t *metrics, uint64_t load,
+                         uint64_t visits ) {
+    if ( visits == 0 ) {
+        return 0;
+    }
+    return 100.0 * (double)load / (double)visits /
+           (double)metrics->bus_capacity;
+}
+
+void print_metrics( FILE *out, resort_metrics_t *metrics ) {
+    uint64_t trips = __atomic_load_n( metrics->trips, __ATOMIC_RELAXED );
+    uint64_t trips_load =
+        __atomic_load_n( metrics->trips_load, __ATOMIC_RELAXED );
+
+    uint64_t visits = 0;
+    uint64_t load = 0;
+    for ( int i = 0; i < metrics->stops_amount; i++ ) {
+        visits +=
+            __atomic_load_n( &metrics->stops[ i ].visits, __ATOMIC_RELAXED );
+        load += __atomic_load_n( &metrics->stops[ i ].load, __ATOMIC_RELAXED );
+    }
+
+    (void)fprintf( out,
+                   "trips: %llu, occupancy leaving stops %.1f%%, arriving "
+                   "to final %.1f%%, start spread %.3f ms\n",
+                   (unsigned long long)trips,
+                   occupancy( metrics, load, visits ),
+                   occupancy( metrics, trips_load, trips ),
+                   (double)metrics_start_spread( metrics ) / 1e6 );
+
+    (void)fprintf( out, "%-12s %10s %10s %10s %10s %10s\n", "ms", "skiers",
+                   "p50", "p95", "p99", "max" );
+    print_durations( out, "walk", metrics->walk );
+    for ( int i = 0; i < metrics->stops_amount; i++ ) {
+        char name[ 32 ];
+        (void)snprintf( name, sizeof( name ), "wait stop %i", i + 1 );
+        print_durations( out, name, &metrics->waits[ i ] );
+    }
+    print_durations( out, "ride", metrics->ride );
+
+    // Skibuses a skier was left behind by, in the same buckets as durations
+    metrics_histogram_t *passes = metrics->passes_waited;
+    uint64_t skiers = histogram_count( passes );
+    if ( skiers > 0 ) {
+        (void)fprintf( out, "%-12s %10s %10s %10s %10s %10s\n",
+                       "bus passes", "skiers", "p50", "p95", "p99", "max" );
+        (void)fprintf(
+            out, "%-12s %10llu %10llu %10llu %10llu %10llu\n", "waited",
+            (unsigned long long)skiers,
+            (unsigned long long)histogram_percentile( passes, skiers, 0.5 ),
+            (unsigned long long)histogram_percentile( passes, skiers, 0.95 ),
+            (unsigned long long)histogram_percentile( passes, skiers, 0.99 ),
+            (unsigned long long)__atomic_load_n( &passes->max_ns,
+                                                 __ATOMIC_RELAXED ) );
+    }
+
+    (void)fprintf( out, "%-12s %10s %10s %10s %12s %10s\n", "stop",
+                   "visits", "skips", "boarded", "per visit", "occupancy" );
+    for ( int i = 0; i < metrics->stops_amount; i++ ) {
+        stop_metrics_t *stop = &metrics->stops[ i ];
+        uint64_t stop_visits =
+            __atomic_load_n( &stop->visits, __ATOMIC_RELAXED );
+        uint64_t boarded = __atomic_load_n( &stop->boarded, __ATOMIC_RELAXED );
+        uint64_t stop_load = __atomic_load_n( &stop->load, __ATOMIC_RELAXED );
+        uint64_t skips = __atomic_load_n( &stop->skips, __ATOMIC_RELAXED );
+        (void)fprintf(
+            out, "%-12i %10llu %10llu %10llu %12.2f %9.1f%%\n", i + 1,
+            (unsigned long long)stop_visits, (unsigned long long)skips,
+            (unsigned long long)boarded,
+            stop_visits > 0 ? (double)boarded / (double)stop_visits : 0.0,
+            occupancy( metrics, stop_load, stop_visits ) );
+    }
+}
@@ -0,0 +1,231 @@
+#include "../include/metrics_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/ski_resort.h"
+#include "../include/sync_stats.h"
+
+// A client that does not read its snapshot is dropped after this long, so
+// it cannot hold up the server nor the end of the simulation
+enum { METRICS_SEND_TIMEOUT_MS = 1000 };
+
+void write_metrics_snapshot( FILE *out, ski_resort_t *resort,
+                             journal_t *journal ) {
+    resort_metrics_t *metrics = &resort->metrics;
+    (void)fprintf( out, "skiers %i\n", resort->skiers_amount );
+    (void)fprintf( out, "skiers_started %llu\n",
+                   (unsigned long long)__atomic_load_n(
+                       metrics->skiers_started, __ATOMIC_RELAXED ) );
+    (void)fprintf(
+        out, "skiers_at_resort %i\n",
+        __atomic_load_n( resort->skiers_at_resort, __ATOMIC_RELAXED ) );
+    (void)fprintf( out, "trips %llu\n",
+                   (unsigned long long)__atomic_load_n( metrics->trips,
+                                                        __ATOMIC_RELAXED ) );
+
+    for ( int i = 0; i < resort->stops_amount; i++ ) {
+        bus_stop_t *bus_stop = &resort->stops[ i ];
+        (void)fprintf(
+            out, "stop %i waiting %i walking %i boarded %llu\n", i + 1,
+            __atomic_load_n( &bus_stop->waiting_skiers_amount,
+                             __ATOMIC_RELAXED ),
+            __atomic_load_n( &bus_stop->skiers_en_route, __ATOMIC_RELAXED ),
+            (unsigned long long)__atomic_load_n( &metrics->stops[ i ].boarded,
+                                                 __ATOMIC_RELAXED ) );
+    }
+
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        skibus_t *bus = &resort->buses[ i ];
+        (void)fprintf(
+            out, "bus %i position %i passengers %i\n", i + 1,
+            __atomic_load_n( &bus->position, __ATOMIC_RELAXED ),
+            __atomic_load_n( &bus->capacity_taken, __ATOMIC_RELAXED ) );
+    }
+
+    (void)fprintf(
+        out, "journal_entries %i\n",
+        __atomic_load_n( journal->message_incr, __ATOMIC_RELAXED ) - 1 );
+    print_sync_stats_totals( out );
+}
+
+/// @brief Send a snapshot to a client that connected.
+static void serve_client( metrics_server_t *server, int client_fd ) {
+    struct timeval timeout = { METRICS_SEND_TIMEOUT_MS / 1000,
+                               METRICS_SEND_TIMEOUT_MS % 1000 * 1000 };
+    (void)setsockopt( client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                      sizeof( timeout ) );
+
+    char *snapshot = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream( &snapshot, &size );
+    if ( out == NULL ) {
+        return;
+    }
+    write_metrics_snapshot( out, server->resort, server->journal );
+    if ( fclose( out ) != 0 ) {
+        free( snapshot );
+        return;
+    }
+
+    // A client that hung up must not kill the main process by SIGPIPE
+    size_t sent = 0;
+    while ( sent < size ) {
+        ssize_t written =
+            send( client_fd, snapshot + sent, size - sent, MSG_NOSIGNAL );
+        if ( written == -1 && errno == EINTR ) {
+            continue;
+        }
+        if ( written <= 0 ) {
+            break;
+        }
+        sent += (size_t)written;
+    }
+    free( snapshot );
+}
+
+static void *server_thread( void *arg ) {
+    metrics_server_t *server = arg;
+    struct pollfd fds[ 2 ] = { { server->listen_fd, POLLIN, 0 },
+                               { server->stop_fd, POLLIN, 0 } };
+    while ( true ) {
+        if ( poll( fds, 2, -1 ) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return NULL;
+        }
+        if ( fds[ 1 ].revents != 0 ) {
+            return NULL;
+        }
+        if ( ( fds[ 0 ].revents & POLLIN ) == 0 ) {
+            continue;
+        }
+
+        int client_fd = accept( server->listen_fd, NULL, NULL );
+        if ( client_fd == -1 ) {
+            continue;
+        }
+        serve_client( server, client_fd );
+        close( client_fd );
+    }
+}
+
+/// @brief Whether a socket at `address` is left behind, nobody accepts on it.
+/// Anything else at the path, a regular file for one, is never stale.
+static bool is_stale_socket( struct sockaddr_un *address ) {
+    struct stat status;
+    if ( lstat( address->sun_path, &status ) == -1 ||
+         !S_ISSOCK( status.st_mode ) ) {
+        return false;
+    }
+
+    int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if ( fd == -1 ) {
+        return false;
+    }
+    bool stale = connect( fd, (struct sockaddr *)address,
+                          sizeof( *address ) ) == -1 &&
+                 errno == ECONNREFUSED;
+    close( fd );
+    return stale;
+}
+
+/// @brief Bind a listening socket to `path`.
+/// @return The socket. -1 with a message printed on error.
+static int listen_on( char *path ) {
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof( address.sun_path ) ) {
+        (void)fprintf( stderr, "metrics socket path %s is too long\n",
+                       path );
+        return -1;
+    }
+    strcpy( address.sun_path, path );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if ( fd == -1 ) {
+        (void)fprintf( stderr, "failed to create the metrics socket\n" );
+        return -1;
+    }
+    int result = bind( fd, (struct sockaddr *)&address, sizeof( address ) );
+    int bind_error = errno;
+    if ( result == -1 && bind_error == EADDRINUSE &&
+         is_stale_socket( &address ) ) {
+        (void)unlink( path );
+        result = bind( fd, (struct sockaddr *)&address, sizeof( address ) );
+        bind_error = errno;
+    }
+    if ( result == -1 ) {
+        (void)fprintf( stderr, "failed to bind the metrics socket %s: %s\n",
+                       path, strerror( bind_error ) );
+        close( fd );
+        return -1;
+    }
+    if ( listen( fd, SOMAXCONN ) == -1 ) {
+        (void)fprintf( stderr, "failed to listen on the metrics socket %s\n",
+                       path );
+        close( fd );
+        (void)unlink( path );
+        return -1;
+    }
+    return fd;
+}
+
+int start_metrics_server( metrics_server_t *server, char *path,
+                          ski_resort_t *resort, journal_t *journal ) {
+    server->path = path;
+    server->resort = resort;
+    server->journal = journal;
+    server->listen_fd = listen_on( path );
+    if ( server->listen_fd == -1 ) {
+        return -1;
+    }
+
+    server->stop_fd = eventfd( 0, EFD_CLOEXEC );
+    if ( server->stop_fd == -1 ) {
+        (void)fprintf( stderr, "failed to start the metrics server\n" );
+        close( server->listen_fd );
+        server->listen_fd = -1;
+        (void)unlink( path );
+        return -1;
+    }
+    if ( pthread_create( &server->thread, NULL, server_thread, server ) !=
+         0 ) {
+        (void)fprintf( stderr, "failed to start the metrics server\n" );
+        close( server->stop_fd );
+        close( server->listen_fd );
+        server->listen_fd = -1;
+        (void)unlink( path );
+        return -1;
+    }
+    return 0;
+}
+
+void stop_metrics_server( metrics_server_t *server ) {
+    if ( server->listen_fd == -1 ) {
+        return;
+    }
+
+    (void)eventfd_write( server->stop_fd, 1 );
+    pthread_join( server->thread, NULL );
+
+    close( server->stop_fd );
+    close( server->listen_fd );
+    server->listen_fd = -1;
+    (void)unlink( server->path );
+}
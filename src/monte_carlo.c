@@ -0,0 +1,314 @@
+#include "../include/monte_carlo.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/child_process.h"
+#include "../include/metrics.h"
+#include "../include/random.h"
+#include "../include/sharing.h"
+#include "../include/simulation.h"
+#include "../include/ski_resort.h"
+
+// Arena of a run, named after the arena of the Monte Carlo process
+#define RUN_ARENA_NAME_FORMAT "%s.run%i"
+
+enum { NS_PER_MS = 1000 * 1000 };
+
+/// @brief Reports of all the runs. Children write them into memory shared
+/// with the parent, which aggregates them once every run has finished.
+struct run_reports {
+    run_report_t *reports;
+    // Stops of all the reports, `stops_amount` per run
+    stop_metrics_t *stops;
+    bool *succeeded;
+    size_t size;
+};
+typedef struct run_reports run_reports_t;
+
+static int init_run_reports( run_reports_t *reports, int runs,
+                             int stops_amount ) {
+    size_t reports_size = shared_object_size( sizeof( run_report_t ) * runs );
+    size_t stops_size = shared_object_size(
+        sizeof( stop_metrics_t ) * (size_t)stops_amount * (size_t)runs );
+    size_t succeeded_size = shared_object_size( sizeof( bool ) * runs );
+    reports->size = reports_size + stops_size + succeeded_size;
+
+    char *base = mmap( NULL, reports->size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if ( base == MAP_FAILED ) {
+        return -1;
+    }
+    reports->reports = (run_report_t *)base;
+    reports->stops = (stop_metrics_t *)( base + reports_size );
+    reports->succeeded = (bool *)( base + reports_size + stops_size );
+
+    for ( int i = 0; i < runs; i++ ) {
+        reports->reports[ i ].stops = &reports->stops[ i * stops_amount ];
+    }
+    return 0;
+}
+
+static void destroy_run_reports( run_reports_t *reports ) {
+    munmap( reports->reports, reports->size );
+}
+
+/// @brief Body of a run's process. Never returns.
+static void run_once( arguments_t *args, char *arena_name, int run_idx,
+                      run_report_t *report ) {
+    char shm_name[ SHARED_ARENA_NAME_MAX_SIZE ];
+    int length = snprintf( shm_name, sizeof( shm_name ), RUN_ARENA_NAME_FORMAT,
+                           arena_name, run_idx );
+    if ( length < 0 || (size_t)length >= sizeof( shm_name ) ) {
+        (void)fprintf( stderr, "shared memory name %s is too long\n",
+                       arena_name );
+        exit( EXIT_FAILURE );
+    }
+
+    arguments_t run_args = *args;
+    run_args.seed = derive_seed( args->seed, (uint64_t)run_idx );
+    run_args.shm_name = shm_name;
+    // Runs would all listen on the same socket
+    run_args.metrics_socket = NULL;
+    run_args.report = report;
+    run_args.report_timing = false;
+    run_args.print_metrics = false;
+    run_args.output = fopen( "/dev/null", "we" );
+    if ( run_args.output == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+
+    int result = run_simulation( &run_args );
+    (void)fclose( run_args.output );
+    exit( result == -1 ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+static int compare_doubles( const void *a, const void *b ) {
+    double value_a = *(const double *)a;
+    double value_b = *(const double *)b;
+    return ( value_a > value_b ) - ( value_a < value_b );
+}
+
+/// @brief Nearest-rank percentile of sorted values.
+static double percentile( double *sorted, int amount, double fraction ) {
+    double exact_rank = fraction * amount;
+    int rank = (int)exact_rank;
+    if ( rank < exact_rank ) {
+        rank++;
+    }
+    return sorted[ rank > 0 ? rank - 1 : 0 ];
+}
+
+/// @brief Print a row of the mean and percentiles of `values`, which get
+/// sorted.
+static void print_row( char *name, double *values, int amount ) {
+    if ( amount == 0 ) {
+        (void)printf( "%-18s %10s\n", name, "-" );
+        return;
+    }
+
+    double sum = 0;
+    for ( int i = 0; i < amount; i++ ) {
+        sum += values[ i ];
+    }
+    qsort( values, (size_t)amount, sizeof( double ), compare_doubles );
+    (void)printf( "%-18s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+                  sum / amount, percentile( values, amount, 0.5 ),
+                  percentile( values, amount, 0.95 ),
+                  percentile( values, amount, 0.99 ), values[ amount - 1 ] );
+}
+
+static int print_aggregate( arguments_t *args, run_reports_t *reports,
+                            int runs, int jobs ) {
+    double *values = malloc( sizeof( double ) * runs );
+    if ( values == NULL ) {
+        return -1;
+    }
+
+    int succeeded = 0;
+    int slowest = -1;
+    for ( int i = 0; i < runs; i++ ) {
+        if ( !reports->succeeded[ i ] ) {
+            continue;
+        }
+        run_report_t *report = &reports->reports[ i ];
+        values[ succeeded++ ] = (double)report->finish_ns / NS_PER_MS;
+        if ( slowest == -1 ||
+             report->finish_ns > reports->reports[ slowest ].finish_ns ) {
+            slowest = i;
+        }
+    }
+
+    (void)printf( "runs: %i succeeded of %i, %i at once, seed %llu\n",
+                  succeeded, runs, jobs, (unsigned long long)args->seed );
+    (void)printf( "%-18s %10s %10s %10s %10s %10s\n", "", "mean", "p50", "p95",
+                  "p99", "max" );
+    print_row( "finish ms", values, succeeded );
+
+    int amount = 0;
+    for ( int i = 0; i < runs; i++ ) {
+        if ( reports->succeeded[ i ] ) {
+            values[ amount++ ] = (double)reports->reports[ i ].trips;
+        }
+    }
+    print_row( "trips", values, amount );
+
+    amount = 0;
+    for ( int i = 0; i < runs; i++ ) {
+        if ( reports->succeeded[ i ] ) {
+            values[ amount++ ] =
+                (double)reports->reports[ i ].start_spread_ns / NS_PER_MS;
+        }
+    }
+    print_row( "start spread ms", values, amount );
+
+    amount = 0;
+    for ( int i = 0; i < runs; i++ ) {
+        if ( reports->succeeded[ i ] ) {
+            values[ amount++ ] =
+                (double)reports->reports[ i ].max_passes_waited;
+        }
+    }
+    print_row( "max bus passes", values, amount );
+
+    // Passengers on board of skibuses leaving stops, in percent of capacity
+    amount = 0;
+    for ( int i = 0; i < runs; i++ ) {
+        if ( !reports->succeeded[ i ] ) {
+            continue;
+        }
+        uint64_t visits = 0;
+        uint64_t load = 0;
+        for ( int stop_idx = 0; stop_idx < args->stops_amount; stop_idx++ ) {
+            visits += reports->reports[ i ].stops[ stop_idx ].visits;
+            load += reports->reports[ i ].stops[ stop_idx ].load;
+        }
+        if ( visits > 0 ) {
+            values[ amount++ ] = 100.0 * (double)load / (double)visits /
+                                 (double)args->bus_capacity;
+        }
+    }
+    print_row( "occupancy %", values, amount );
+
+    // Mean wait of a run at a stop, runs nobody boarded at the stop in are
+    // left out
+    for ( int stop_idx = 0; stop_idx < args->stops_amount; stop_idx++ ) {
+        amount = 0;
+        for ( int i = 0; i < runs; i++ ) {
+            stop_metrics_t *stop = &reports->reports[ i ].stops[ stop_idx ];
+            if ( reports->succeeded[ i ] && stop->boarded > 0 ) {
+                values[ amount++ ] = (double)stop->wait_ns /
+                                     (double)stop->boarded / NS_PER_MS;
+            }
+        }
+        char name[ 32 ];
+        (void)snprintf( name, sizeof( name ), "stop %i wait ms",
+                        stop_idx + 1 );
+        print_row( name, values, amount );
+    }
+
+    if ( slowest != -1 ) {
+        (void)printf( "slowest run: --seed=%llu\n",
+                      (unsigned long long)derive_seed( args->seed,
+                                                       (uint64_t)slowest ) );
+    }
+
+    free( values );
+    return 0;
+}
+
+int run_monte_carlo( arguments_t *args, int runs, int jobs ) {
+    run_reports_t reports;
+    if ( init_run_reports( &reports, runs, args->stops_amount ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        return -1;
+    }
+
+    pid_t *job_pids = malloc( sizeof( pid_t ) * jobs );
+    int *job_runs = malloc( sizeof( int ) * jobs );
+    if ( job_pids == NULL || job_runs == NULL ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        free( job_pids );
+        free( job_runs );
+        destroy_run_reports( &reports );
+        return -1;
+    }
+
+    char instance_name[ SHARED_ARENA_NAME_MAX_SIZE ];
+    char *arena_name = args->shm_name;
+    if ( arena_name == NULL ) {
+        instance_shm_name( instance_name, SHM_ARENA_BASE_NAME );
+        arena_name = instance_name;
+    }
+
+    // Buffered output must not be duplicated into the children
+    (void)fflush( stdout );
+
+    int result = 0;
+    int next_run = 0;
+    int running = 0;
+    while ( next_run < runs || running > 0 ) {
+        // Keep `jobs` runs going
+        while ( next_run < runs && running < jobs ) {
+            // A run and, through it, its own children die with this process
+            pid_t pid = fork_dependent_child();
+            if ( pid < 0 ) {
+                (void)fprintf( stderr, "failed to fork run %i\n",
+                               next_run + 1 );
+                result = -1;
+                next_run = runs;
+                break;
+            }
+            if ( pid == 0 ) {
+                run_once( args, arena_name, next_run,
+                          &reports.reports[ next_run ] );
+            }
+            job_pids[ running ] = pid;
+            job_runs[ running ] = next_run;
+            running++;
+            next_run++;
+        }
+        if ( running == 0 ) {
+            break;
+        }
+
+        int stat_loc = 0;
+        pid_t pid = wait( &stat_loc );
+        if ( pid == -1 ) {
+            break;
+        }
+        for ( int i = 0; i < running; i++ ) {
+            if ( job_pids[ i ] != pid ) {
+                continue;
+            }
+            int run_idx = job_runs[ i ];
+            reports.succeeded[ run_idx ] =
+                WIFEXITED( stat_loc ) && WEXITSTATUS( stat_loc ) == 0;
+            if ( !reports.succeeded[ run_idx ] ) {
+                (void)fprintf( stderr, "run %i failed\n", run_idx + 1 );
+                result = -1;
+            }
+            // Keep the running jobs at the front
+            running--;
+            job_pids[ i ] = job_pids[ running ];
+            job_runs[ i ] = job_runs[ running ];
+            break;
+        }
+    }
+
+    if ( print_aggregate( args, &reports, runs, jobs ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        result = -1;
+    }
+
+    free( job_pids );
+    free( job_runs );
+    destroy_run_reports( &reports );
+    return result;
+}
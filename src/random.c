@@ -1,18 +1,81 @@
 #include "../include/random.h"
 
-#include <stdbool.h>
-#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
-void set_rand_seed() {
-    static bool initialized = 0;
-    if ( !initialized ) {
-        srand( getpid() );
-        initialized = 1;
+// Streams are xoshiro256** generators whose state is filled by splitmix64
+
+static uint64_t rand_seed = 0;
+
+static uint64_t splitmix64( uint64_t *state ) {
+    uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+    z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+    return z ^ ( z >> 31 );
+}
+
+static uint64_t rotl( uint64_t x, int k ) {
+    return ( x << k ) | ( x >> ( 64 - k ) );
+}
+
+static uint64_t next_number( rand_stream_t *stream ) {
+    uint64_t *s = stream->state;
+    uint64_t result = rotl( s[ 1 ] * 5, 7 ) * 9;
+    uint64_t t = s[ 1 ] << 17;
+
+    s[ 2 ] ^= s[ 0 ];
+    s[ 3 ] ^= s[ 1 ];
+    s[ 1 ] ^= s[ 2 ];
+    s[ 0 ] ^= s[ 3 ];
+    s[ 2 ] ^= t;
+    s[ 3 ] = rotl( s[ 3 ], 45 );
+
+    return result;
+}
+
+void set_rand_seed( uint64_t seed ) {
+    rand_seed = seed;
+}
+
+uint64_t random_seed( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    uint64_t state = (uint64_t)now.tv_sec * 1000000000ULL +
+                     (uint64_t)now.tv_nsec + (uint64_t)getpid();
+    return splitmix64( &state );
+}
+
+uint64_t derive_seed( uint64_t seed, uint64_t index ) {
+    // The index-th number of a splitmix64 sequence started at the seed
+    uint64_t state = seed + index * 0x9e3779b97f4a7c15ULL;
+    return splitmix64( &state );
+}
+
+void init_rand_stream( rand_stream_t *stream, uint64_t entity_id ) {
+    // Scramble the seed and the id separately, so streams of neighbouring
+    // ids and seeds are unrelated
+    uint64_t seed_state = rand_seed;
+    uint64_t state = splitmix64( &seed_state ) ^ entity_id;
+    for ( int i = 0; i < 4; i++ ) {
+        stream->state[ i ] = splitmix64( &state );
     }
 }
 
-int rand_number( int max ) {
-    set_rand_seed();
-    return ( rand() % max ) + 1;
+int rand_number( rand_stream_t *stream, int max ) {
+    if ( max <= 0 ) {
+        return 0;
+    }
+
+    // Multiply-shift maps a 32-bit number into the range, numbers below
+    // the threshold would make some results more likely and are redrawn
+    uint32_t range = (uint32_t)max;
+    uint64_t product = ( next_number( stream ) >> 32 ) * range;
+    if ( (uint32_t)product < range ) {
+        uint32_t threshold = -range % range;
+        while ( (uint32_t)product < threshold ) {
+            product = ( next_number( stream ) >> 32 ) * range;
+        }
+    }
+    return (int)( product >> 32 ) + 1;
 }
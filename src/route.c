@@ -0,0 +1,188 @@
+#include "../include/route.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/random.h"
+
+enum { DECIMAL_BASE = 10, INITIAL_SEGMENTS = 64 };
+
+/// @brief Make room for prefix sums of `stops_amount` segments.
+static int reserve_segments( route_t *route, int stops_amount ) {
+    size_t size = sizeof( int ) * ( (size_t)stops_amount + 1 );
+    int *min_us = realloc( route->min_us, size );
+    if ( min_us == NULL ) {
+        return -1;
+    }
+    route->min_us = min_us;
+    int *max_us = realloc( route->max_us, size );
+    if ( max_us == NULL ) {
+        return -1;
+    }
+    route->max_us = max_us;
+    return 0;
+}
+
+static void add_segment( route_t *route, int min_us, int max_us ) {
+    int idx = route->stops_amount++;
+    route->min_us[ idx + 1 ] = route->min_us[ idx ] + min_us;
+    route->max_us[ idx + 1 ] = route->max_us[ idx ] + max_us;
+}
+
+static void init_empty_route( route_t *route ) {
+    route->stops_amount = 0;
+    route->min_us = NULL;
+    route->max_us = NULL;
+}
+
+int init_uniform_route( route_t *route, int stops_amount, int max_ride_us ) {
+    init_empty_route( route );
+    if ( reserve_segments( route, stops_amount ) == -1 ) {
+        destroy_route( route );
+        return -1;
+    }
+    route->min_us[ 0 ] = 0;
+    route->max_us[ 0 ] = 0;
+
+    // `rand_number()` never draws 0 for a positive maximum
+    int min_us = max_ride_us > 0 ? 1 : 0;
+    for ( int i = 0; i < stops_amount; i++ ) {
+        add_segment( route, min_us, max_ride_us );
+    }
+    return 0;
+}
+
+/// @brief Parse a number of a segment and skip the whitespace after it.
+/// @return -1 if there is no number or it is out of 0..max.
+static int parse_ride( char **cursor, int max, int *ride_us ) {
+    char *endptr = NULL;
+    errno = 0;
+    long value = strtol( *cursor, &endptr, DECIMAL_BASE );
+    if ( endptr == *cursor || errno == ERANGE || value < 0 || value > max ) {
+        return -1;
+    }
+    *ride_us = (int)value;
+    while ( isspace( (unsigned char)*endptr ) ) {
+        endptr++;
+    }
+    *cursor = endptr;
+    return 0;
+}
+
+/// @brief Parse a line of a route file into the route.
+/// @return -1 with a message printed if the line is malformed.
+static int parse_line( route_t *route, char *line, const char *path,
+                       int line_number, int max_stops, int max_ride_us,
+                       int *capacity ) {
+    char *cursor = line;
+    while ( isspace( (unsigned char)*cursor ) ) {
+        cursor++;
+    }
+    if ( *cursor == '\0' || *cursor == '#' ) {
+        return 0;
+    }
+
+    int min_us = 0;
+    int max_us = 0;
+    if ( parse_ride( &cursor, max_ride_us, &min_us ) == -1 ||
+         parse_ride( &cursor, max_ride_us, &max_us ) == -1 ||
+         *cursor != '\0' ) {
+        (void)fprintf( stderr,
+                       "%s:%i: expected \"<shortest> <longest>\" ride in "
+                       "0..%i microseconds\n",
+                       path, line_number, max_ride_us );
+        return -1;
+    }
+    if ( min_us > max_us ) {
+        (void)fprintf( stderr, "%s:%i: shortest ride is longer than the "
+                       "longest one\n",
+                       path, line_number );
+        return -1;
+    }
+    if ( route->stops_amount == max_stops ) {
+        (void)fprintf( stderr, "%s: route has more than %i stops\n", path,
+                       max_stops );
+        return -1;
+    }
+
+    if ( route->stops_amount == *capacity ) {
+        *capacity *= 2;
+        if ( reserve_segments( route, *capacity ) == -1 ) {
+            (void)fprintf( stderr, "failed to allocate enough memory\n" );
+            return -1;
+        }
+    }
+    add_segment( route, min_us, max_us );
+    return 0;
+}
+
+int load_route( route_t *route, const char *path, int max_stops,
+                int max_ride_us ) {
+    init_empty_route( route );
+    FILE *file = fopen( path, "re" );
+    if ( file == NULL ) {
+        (void)fprintf( stderr, "failed to open route %s\n", path );
+        return -1;
+    }
+
+    int capacity = INITIAL_SEGMENTS;
+    if ( reserve_segments( route, capacity ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        (void)fclose( file );
+        destroy_route( route );
+        return -1;
+    }
+    route->min_us[ 0 ] = 0;
+    route->max_us[ 0 ] = 0;
+
+    char line[ ROUTE_LINE_MAX_SIZE ];
+    int line_number = 0;
+    int result = 0;
+    while ( result == 0 && fgets( line, sizeof( line ), file ) != NULL ) {
+        line_number++;
+        size_t length = strlen( line );
+        if ( length == sizeof( line ) - 1 && line[ length - 1 ] != '\n' ) {
+            (void)fprintf( stderr, "%s:%i: line is too long\n", path,
+                           line_number );
+            result = -1;
+            break;
+        }
+        result = parse_line( route, line, path, line_number, max_stops,
+                             max_ride_us, &capacity );
+    }
+    if ( result == 0 && ferror( file ) ) {
+        (void)fprintf( stderr, "failed to read route %s\n", path );
+        result = -1;
+    }
+    if ( result == 0 && route->stops_amount == 0 ) {
+        (void)fprintf( stderr, "%s: route has no stops\n", path );
+        result = -1;
+    }
+
+    (void)fclose( file );
+    if ( result == -1 ) {
+        destroy_route( route );
+    }
+    return result;
+}
+
+void destroy_route( route_t *route ) {
+    free( route->min_us );
+    free( route->max_us );
+    route->min_us = NULL;
+    route->max_us = NULL;
+    route->stops_amount = 0;
+}
+
+int route_ride_time( route_t *route, int first_idx, int last_idx,
+                     rand_stream_t *random ) {
+    int min_us = route->min_us[ last_idx + 1 ] - route->min_us[ first_idx ];
+    int max_us = route->max_us[ last_idx + 1 ] - route->max_us[ first_idx ];
+    if ( min_us == max_us ) {
+        return min_us;
+    }
+    return min_us - 1 + rand_number( random, max_us - min_us + 1 );
+}
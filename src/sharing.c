@@ -1,30 +1,49 @@
+#include "../include/sharing.h"
+
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-int allocate_shm( char *shm_name, size_t size );
-void free_shm( char *shm_name, void **addr, size_t len );
+#include "../include/random.h"
 
-int allocate_semaphore( int shm_fd, sem_t **sem, int value );
-void free_semaphore( sem_t **sem );
+int allocate_shm( char *shm_name, size_t size );
 
 enum { RW_ACCESS = 0666 };
 
+enum { DECIMAL_BASE = 10 };
+
+// Where Linux keeps the POSIX shared memory objects
+#define SHM_DIRECTORY "/dev/shm"
+
+// Size of a huge page on x86-64 and aarch64 with 4K base pages
+enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+static size_t align_up( size_t size, size_t alignment ) {
+    return ( size + alignment - 1 ) / alignment * alignment;
+}
+
+size_t shared_object_size( size_t size ) {
+    return align_up( size, CACHE_LINE_SIZE );
+}
+
 int allocate_shm( char *shm_name, size_t size ) {
+    // A segment of the name belongs to another simulation or to a crashed
+    // one, reusing it would mix their state
     int shm_fd = shm_open( shm_name, O_CREAT | O_EXCL | O_RDWR, RW_ACCESS );
-    if ( shm_fd == -1 ) {
-        shm_fd = shm_open( shm_name, O_CREAT | O_RDWR, RW_ACCESS );
-    }
-
     if ( shm_fd == -1 ) {
         return -1;
     }
     if ( ftruncate( shm_fd, (off_t)size ) == -1 ) {
+        close( shm_fd );
         shm_unlink( shm_name );
         return -1;
     }
@@ -32,71 +51,180 @@ int allocate_shm( char *shm_name, size_t size ) {
     return shm_fd;
 }
 
-void free_shm( char *shm_name, void **addr, size_t len ) {
-    munmap( *addr, len );
-    shm_unlink( shm_name );
+void instance_shm_name( char *name, const char *base ) {
+    (void)snprintf( name, SHARED_ARENA_NAME_MAX_SIZE, "/%s.%ld.%08x", base,
+                    (long)getpid(), (unsigned)random_seed() );
+}
+
+int sweep_stale_shm( const char *base ) {
+    DIR *directory = opendir( SHM_DIRECTORY );
+    if ( directory == NULL ) {
+        return 0;
+    }
+
+    size_t base_length = strlen( base );
+    int removed = 0;
+    struct dirent *entry;
+    while ( ( entry = readdir( directory ) ) != NULL ) {
+        if ( strncmp( entry->d_name, base, base_length ) != 0 ||
+             entry->d_name[ base_length ] != '.' ) {
+            continue;
+        }
+        char *pid_text = entry->d_name + base_length + 1;
+        char *end = NULL;
+        long pid = strtol( pid_text, &end, DECIMAL_BASE );
+        if ( end == pid_text || *end != '.' || pid <= 0 ) {
+            continue;
+        }
+        // Processes of other users are alive as well
+        if ( kill( (pid_t)pid, 0 ) == 0 || errno != ESRCH ) {
+            continue;
+        }
+
+        char shm_name[ SHARED_ARENA_NAME_MAX_SIZE ];
+        int length = snprintf( shm_name, sizeof( shm_name ), "/%s",
+                               entry->d_name );
+        if ( length > 0 && (size_t)length < sizeof( shm_name ) &&
+             shm_unlink( shm_name ) == 0 ) {
+            removed++;
+        }
+    }
+    closedir( directory );
+    return removed;
+}
+
+/// @brief Map anonymous huge pages. Only forked processes can share them,
+/// which is all this program needs.
+static void *allocate_huge_pages( size_t size, bool process_shared ) {
+#ifdef MAP_HUGETLB
+    int visibility = process_shared ? MAP_SHARED : MAP_PRIVATE;
+    void *addr = mmap( NULL, size, PROT_READ | PROT_WRITE,
+                       visibility | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( addr != MAP_FAILED ) {
+        return addr;
+    }
+#else
+    (void)size;
+    (void)process_shared;
+#endif
+    return NULL;
 }
 
-int allocate_semaphore( int shm_fd, sem_t **sem, int value ) {
-    *sem = mmap( NULL, sizeof( sem_t ), PROT_READ | PROT_WRITE, MAP_SHARED,
-                 shm_fd, 0 );
-    if ( sem == MAP_FAILED ) {
+int init_shared_arena( shared_arena_t *arena, size_t size, char *shm_name,
+                       bool process_shared, bool huge_pages ) {
+    if ( arena == NULL || shm_name == NULL ||
+         strlen( shm_name ) >= SHARED_ARENA_NAME_MAX_SIZE ) {
         return -1;
     }
 
-    if ( sem_init( *sem, true, value ) == -1 ) {
-        sem_destroy( *sem );
+    arena->used = 0;
+    arena->process_shared = process_shared;
+    arena->shm_name[ 0 ] = '\0';
+
+    if ( huge_pages ) {
+        arena->size = align_up( size, HUGE_PAGE_SIZE );
+        arena->base = allocate_huge_pages( arena->size, process_shared );
+        if ( arena->base != NULL ) {
+            return 0;
+        }
+    }
+
+    arena->size = align_up( size, (size_t)sysconf( _SC_PAGESIZE ) );
+    // Mapping of zero bytes is invalid
+    if ( arena->size == 0 ) {
+        arena->size = (size_t)sysconf( _SC_PAGESIZE );
+    }
+
+    if ( !process_shared ) {
+        arena->base = mmap( NULL, arena->size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    } else {
+        int shm_fd = allocate_shm( shm_name, arena->size );
+        if ( shm_fd == -1 ) {
+            return -1;
+        }
+        arena->base = mmap( NULL, arena->size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, shm_fd, 0 );
+        // The mapping keeps the segment alive
+        close( shm_fd );
+        if ( arena->base == MAP_FAILED ) {
+            arena->base = NULL;
+            shm_unlink( shm_name );
+            return -1;
+        }
+        strcpy( arena->shm_name, shm_name );
+    }
+
+    if ( arena->base == MAP_FAILED ) {
+        arena->base = NULL;
         return -1;
     }
 
+#ifdef MADV_HUGEPAGE
+    if ( huge_pages ) {
+        // Transparent huge pages are better than nothing
+        (void)madvise( arena->base, arena->size, MADV_HUGEPAGE );
+    }
+#endif
+
     return 0;
 }
 
-void free_semaphore( sem_t **sem ) {
-    munmap( *sem, sizeof( sem_t ) );
-    sem_destroy( *sem );
+void destroy_shared_arena( shared_arena_t *arena ) {
+    if ( arena == NULL || arena->base == NULL ) {
+        return;
+    }
+
+    munmap( arena->base, arena->size );
+    if ( arena->shm_name[ 0 ] != '\0' ) {
+        shm_unlink( arena->shm_name );
+    }
+    arena->base = NULL;
+}
+
+static void *arena_allocate( shared_arena_t *arena, size_t size ) {
+    size_t object_size = shared_object_size( size );
+    if ( arena->base == NULL || arena->size - arena->used < object_size ) {
+        return NULL;
+    }
+
+    void *object = arena->base + arena->used;
+    arena->used += object_size;
+    return object;
 }
 
-int init_semaphore( sem_t **sem, int val, char *shm_name ) {
-    if ( sem == NULL ) {
+int init_semaphore( shared_arena_t *arena, sem_t **sem, int val ) {
+    if ( arena == NULL || sem == NULL ) {
         return -1;
     }
 
-    int shm_fd = allocate_shm( shm_name, sizeof( sem_t ) );
-    if ( shm_fd == -1 ) {
+    *sem = arena_allocate( arena, sizeof( sem_t ) );
+    if ( *sem == NULL ) {
         return -1;
     }
-    if ( allocate_semaphore( shm_fd, sem, val ) == -1 ) {
-        free_shm( shm_name, (void **)sem, sizeof( sem_t ) );
+
+    if ( sem_init( *sem, arena->process_shared, val ) == -1 ) {
         return -1;
     }
     return 0;
 }
 
-void destroy_semaphore( sem_t **sem, char *shm_name ) {
-    free_semaphore( sem );
-    free_shm( shm_name, (void **)sem, sizeof( sem_t ) );
+void destroy_semaphore( sem_t **sem ) {
+    if ( *sem == NULL ) {
+        return;
+    }
+    sem_destroy( *sem );
     *sem = NULL;
 }
 
-int init_shared_var( void **ppdata, size_t size, char *shm_name ) {
-    if ( ppdata == NULL ) {
+int init_shared_var( shared_arena_t *arena, void **ppdata, size_t size ) {
+    if ( arena == NULL || ppdata == NULL ) {
         return -1;
     }
 
-    int shm_fd = allocate_shm( shm_name, size );
-    if ( shm_fd == -1 ) {
-        return -1;
-    }
-
-    *ppdata = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0 );
-    if ( *ppdata == MAP_FAILED ) {
+    *ppdata = arena_allocate( arena, size );
+    if ( *ppdata == NULL ) {
         return -1;
     }
-
     return 0;
 }
-void destroy_shared_var( void **ppdata, size_t size, char *shm_name ) {
-    free_shm( shm_name, ppdata, size );
-    *ppdata = NULL;
-}
@@ -1,15 +1,40 @@
 #include "../include/simulation.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../include/child_process.h"
 #include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/metrics_server.h"
+#include "../include/random.h"
+#include "../include/sharing.h"
 #include "../include/ski_resort.h"
+#include "../include/skier_worker.h"
+#include "../include/sync_stats.h"
+#include "../include/virtual_time.h"
+
+// Skiers only sleep, journal and wait on semaphores, so a small stack is
+// plenty. Keeps memory of a 20k skier run in megabytes instead of gigabytes.
+enum { THREAD_STACK_SIZE = 64 * 1024 };
+
+// How often the main process checks on its children while it waits for them
+// to get to the start
+enum { START_POLL_NS = 10 * 1000 * 1000 };
+// and how many skiers it forks in between while it spawns them
+enum { SPAWN_SUPERVISION_INTERVAL = 64 };
 
 /// @brief Allocate the required memory for starting a simulation.
 /// @param args
@@ -21,120 +46,552 @@ void free_resources( simulation_t *simulation );
 
 int spawn_skier( int skier_idx, simulation_t *simulation );
 
-/// @brief Spawn a skibus process and skiers.
+/// @brief Spawn a worker process running skiers
+/// first_skier_id..first_skier_id+skiers_amount-1.
+int spawn_skier_worker( int first_skier_id, int skiers_amount,
+                        simulation_t *simulation );
+
+/// @brief Kill all the skibus and skier processes created so far and reap
+/// them.
+void kill_processes( simulation_t *simulation );
+
+/// @brief Route SIGCHLD and the signals terminating the main process to a
+/// signalfd, so it reacts to failed children and to being interrupted at
+/// once.
+static int init_supervision( simulation_t *simulation );
+
+static void destroy_supervision( simulation_t *simulation );
+
+/// @brief Start the ski resort once every process waits for the start.
+/// @return -1 if a process failed or the main process was interrupted first.
+/// 0 otherwise.
+static int start_processes( simulation_t *simulation );
+
+/// @brief Spawn the skibus processes and skiers.
 /// @param simulation
 /// @return
 int spawn_processes( simulation_t *simulation );
 
+/// @brief Wait for all the spawned processes to finish.
+/// @return -1 if any of the processes failed or the main process was
+/// interrupted. 0 otherwise.
+int wait_for_processes( simulation_t *simulation );
+
+/// @brief Spawn the skibus threads and skier threads.
+/// @param simulation
+/// @return
+int spawn_threads( simulation_t *simulation );
+
+/// @brief Wait for all the spawned threads to finish.
+/// @return -1 if any of the threads failed. 0 otherwise.
+int wait_for_threads( simulation_t *simulation );
+
+static void *skibus_thread( void *arg );
+static void *skier_thread( void *arg );
+
+static long long monotonic_ns( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void print_timing_report( long long simulation_ns, journal_t *journal ) {
+    int entries =
+        __atomic_load_n( journal->message_incr, __ATOMIC_ACQUIRE ) - 1;
+    (void)fprintf( stderr, TIMING_REPORT_FORMAT, simulation_ns, entries );
+}
+
 int run_simulation( arguments_t *args ) {
+    set_rand_seed( args->seed );
+
+    if ( args->execution_mode == EXEC_VIRTUAL_TIME ) {
+        return run_virtual_time_simulation( args );
+    }
+
     simulation_t simulation;
+    simulation.signal_fd = -1;
+    // The journal writer process, if any, is forked here. It is not part of
+    // the supervised group, so it starts with the signals unblocked and
+    // without the signalfd, and dies with the main process on its own.
     if ( allocate_resources( args, &simulation ) == -1 ) {
         (void)fprintf( stderr, "failed to allocate enough memory\n" );
         return -1;
     }
-
-    if ( spawn_processes( &simulation ) == -1 ) {
-        (void)fprintf( stderr, "failed to spawn all the required processes\n" );
+    // Before any other thread of the main process is started, it would take
+    // the signals instead of the signalfd otherwise
+    if ( args->execution_mode != EXEC_THREADS &&
+         init_supervision( &simulation ) == -1 ) {
+        (void)fprintf( stderr, "failed to set up the supervision of the "
+                               "child processes\n" );
         free_resources( &simulation );
         return -1;
     }
+    // A thread of the main process. It reads the counters while the skibuses
+    // and skiers run, without taking any of their locks.
+    if ( args->metrics_socket != NULL &&
+         start_metrics_server( &simulation.metrics_server,
+                               args->metrics_socket, &simulation.ski_resort,
+                               &simulation.journal ) == -1 ) {
+        free_resources( &simulation );
+        destroy_supervision( &simulation );
+        return -1;
+    }
 
-    start_ski_resort( &simulation.ski_resort );
-
-    // Wait for a skibus and skiers to finish
-    while ( true ) {
-        int child_stat_loc = 0;
-        pid_t child_pid = wait( &child_stat_loc );
-        if ( child_pid == -1 ) {
-            // Main process does not have any more childs
-            break;
-        }
-
-        if ( WEXITSTATUS( child_stat_loc ) == -1 ) {
-            (void)fprintf(
-                stderr,
-                "one of the child processes had exited with exit code (-1)\n" );
-
-            // Kill all processes created
-            kill( simulation.skibus_pid, SIGKILL );
-            for ( int j = 0; j < simulation.ski_resort.skiers_amount; j++ ) {
-                pid_t skier_pid = simulation.skier_pids[ j ];
-                kill( skier_pid, SIGKILL );
-            }
+    int result = 0;
+    long long started_at_ns = 0;
+    if ( simulation.execution_mode == EXEC_THREADS ) {
+        if ( spawn_threads( &simulation ) == -1 ) {
+            (void)fprintf( stderr,
+                           "failed to spawn all the required threads\n" );
+            free_resources( &simulation );
+            return -1;
+        }
 
+        start_ski_resort( &simulation.ski_resort );
+        started_at_ns = monotonic_ns();
+        result = wait_for_threads( &simulation );
+    } else {
+        if ( spawn_processes( &simulation ) == -1 ) {
+            (void)fprintf( stderr,
+                           "failed to spawn all the required processes\n" );
+            abort_journal( &simulation.journal );
             free_resources( &simulation );
+            destroy_supervision( &simulation );
             return -1;
         }
+
+        result = start_processes( &simulation );
+        if ( result == 0 ) {
+            started_at_ns = monotonic_ns();
+            result = wait_for_processes( &simulation );
+        }
+        if ( result == -1 ) {
+            kill_processes( &simulation );
+            abort_journal( &simulation.journal );
+        }
     }
 
+    long long finished_at_ns =
+        (long long)*simulation.ski_resort.finished_at_ns;
+    if ( result == 0 && args->report_timing ) {
+        print_timing_report( finished_at_ns - started_at_ns,
+                             &simulation.journal );
+    }
+    if ( result == 0 && args->report != NULL ) {
+        fill_run_report( args->report, &simulation.ski_resort.metrics,
+                         finished_at_ns - started_at_ns );
+    }
+
+    if ( result == 0 && args->print_metrics ) {
+        print_metrics( stderr, &simulation.ski_resort.metrics );
+    }
+    print_sync_stats( stderr );
     free_resources( &simulation );
+    destroy_supervision( &simulation );
+
+    return result;
+}
+
+static int init_supervision( simulation_t *simulation ) {
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGCHLD );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    sigaddset( &signals, SIGHUP );
+    if ( sigprocmask( SIG_BLOCK, &signals, &simulation->signal_mask ) == -1 ) {
+        return -1;
+    }
+
+    simulation->signal_fd =
+        signalfd( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC );
+    if ( simulation->signal_fd == -1 ) {
+        (void)sigprocmask( SIG_SETMASK, &simulation->signal_mask, NULL );
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_supervision( simulation_t *simulation ) {
+    if ( simulation->signal_fd == -1 ) {
+        return;
+    }
+    close( simulation->signal_fd );
+    simulation->signal_fd = -1;
+    (void)sigprocmask( SIG_SETMASK, &simulation->signal_mask, NULL );
+}
+
+/// @brief Fork a skibus or skier process into the process group.
+/// @return Like fork().
+static pid_t fork_child( simulation_t *simulation ) {
+    // Nobody would tear the group down if the main process is killed
+    pid_t pid = fork_dependent_child();
+    if ( pid < 0 ) {
+        return -1;
+    }
+
+    // Both sides join the group, so it is joined before either goes on. The
+    // first child makes a group of its own.
+    if ( pid == 0 ) {
+        (void)setpgid( 0, simulation->process_group );
+        close( simulation->signal_fd );
+        (void)sigprocmask( SIG_SETMASK, &simulation->signal_mask, NULL );
+        return 0;
+    }
+    (void)setpgid( pid, simulation->process_group );
+    if ( simulation->process_group == 0 ) {
+        simulation->process_group = pid;
+    }
+    simulation->processes_running++;
+    return pid;
+}
 
+/// @brief Reap every child that has exited so far.
+/// @return -1 if any of them failed. 0 otherwise.
+static int reap_children( simulation_t *simulation ) {
+    int stat_loc = 0;
+    pid_t pid;
+    while ( ( pid = waitpid( -1, &stat_loc, WNOHANG ) ) > 0 ) {
+        // The journal writer may be a child as well, it finishes only once
+        // the journal is destroyed
+        if ( simulation->journal.mode == JOURNAL_ASYNC &&
+             !simulation->journal.writer_is_thread &&
+             pid == simulation->journal.writer_pid ) {
+            simulation->journal.writer_pid = 0;
+            (void)fprintf( stderr, "the journal writer process had exited "
+                                   "before the simulation finished\n" );
+            return -1;
+        }
+
+        simulation->processes_running--;
+        if ( WIFSIGNALED( stat_loc ) ) {
+            int signal_number = WTERMSIG( stat_loc );
+            (void)fprintf( stderr,
+                           "one of the child processes was killed by signal "
+                           "%i (%s)\n",
+                           signal_number, strsignal( signal_number ) );
+            return -1;
+        }
+        if ( WIFEXITED( stat_loc ) &&
+             WEXITSTATUS( stat_loc ) != EXIT_SUCCESS ) {
+            (void)fprintf( stderr,
+                           "one of the child processes had exited with exit "
+                           "code %i\n",
+                           WEXITSTATUS( stat_loc ) );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/// @brief Consume the pending signals and reap the exited children.
+/// @return -1 if a child failed or the main process is asked to terminate.
+/// 0 otherwise.
+static int supervise( simulation_t *simulation ) {
+    struct signalfd_siginfo info;
+    while ( read( simulation->signal_fd, &info, sizeof( info ) ) ==
+            sizeof( info ) ) {
+        if ( info.ssi_signo != SIGCHLD ) {
+            (void)fprintf( stderr,
+                           "stopping the simulation on signal %u (%s)\n",
+                           info.ssi_signo, strsignal( (int)info.ssi_signo ) );
+            return -1;
+        }
+    }
+    // Several exits may have been merged into a single SIGCHLD
+    return reap_children( simulation );
+}
+
+static int start_processes( simulation_t *simulation ) {
+    while ( !try_start_ski_resort( &simulation->ski_resort, START_POLL_NS ) ) {
+        if ( supervise( simulation ) == -1 ) {
+            return -1;
+        }
+    }
     return 0;
 }
 
+int wait_for_processes( simulation_t *simulation ) {
+    struct pollfd signals = { simulation->signal_fd, POLLIN, 0 };
+    while ( true ) {
+        if ( supervise( simulation ) == -1 ) {
+            return -1;
+        }
+        if ( simulation->processes_running == 0 ) {
+            return 0;
+        }
+        if ( poll( &signals, 1, -1 ) == -1 && errno != EINTR ) {
+            return -1;
+        }
+    }
+}
+
 int spawn_skier( int skier_idx, simulation_t *simulation ) {
     int skier_id = skier_idx + 1;
 
-    pid_t skier_pid = fork();
+    pid_t skier_pid = fork_child( simulation );
     if ( skier_pid < 0 ) {
         return -1;
     }
     if ( skier_pid == 0 ) {
-        int bus_stop_id = rand_number(simulation->ski_resort.stops_amount);
-        skier_process_behavior( &simulation->ski_resort, skier_id, bus_stop_id,
-                                &simulation->journal );
+        int result = skier_process_behavior( &simulation->ski_resort, skier_id,
+                                             &simulation->journal );
+        exit( result == -1 ? EXIT_FAILURE : EXIT_SUCCESS );
     }
-    simulation->skier_pids[ skier_idx ] = skier_pid;
     return 0;
 }
 
+int spawn_skier_worker( int first_skier_id, int skiers_amount,
+                        simulation_t *simulation ) {
+    pid_t worker_pid = fork_child( simulation );
+    if ( worker_pid < 0 ) {
+        return -1;
+    }
+    if ( worker_pid == 0 ) {
+        int result =
+            skier_worker_behavior( &simulation->ski_resort, first_skier_id,
+                                   skiers_amount, &simulation->journal );
+        exit( result == -1 ? EXIT_FAILURE : EXIT_SUCCESS );
+    }
+    return 0;
+}
+
+void kill_processes( simulation_t *simulation ) {
+    if ( simulation->process_group == 0 ) {
+        return;
+    }
+    (void)kill( -simulation->process_group, SIGKILL );
+    while ( simulation->processes_running > 0 &&
+            waitpid( -simulation->process_group, NULL, 0 ) > 0 ) {
+        simulation->processes_running--;
+    }
+}
+
 int spawn_processes( simulation_t *simulation ) {
-    simulation->skibus_pid = fork();
-    if ( simulation->skibus_pid < 0 ) {
+    for ( int i = 0; i < simulation->ski_resort.buses_amount; i++ ) {
+        pid_t skibus_pid = fork_child( simulation );
+        if ( skibus_pid < 0 ) {
+            kill_processes( simulation );
+            return -1;
+        }
+        if ( skibus_pid == 0 ) {
+            int result = skibus_process_behavior( &simulation->ski_resort, i,
+                                                  &simulation->journal );
+            exit( result == -1 ? EXIT_FAILURE : EXIT_SUCCESS );
+        }
+    }
+
+    int skiers_amount = simulation->ski_resort.skiers_amount;
+    if ( simulation->execution_mode == EXEC_WORKERS ) {
+        // Split skiers into contiguous ranges of nearly equal size
+        int workers_amount = simulation->workers_amount;
+        int first_skier_id = 1;
+        for ( int i = 0; i < workers_amount; i++ ) {
+            int worker_skiers = skiers_amount / workers_amount +
+                                ( i < skiers_amount % workers_amount ? 1 : 0 );
+            if ( spawn_skier_worker( first_skier_id, worker_skiers,
+                                     simulation ) == -1 ) {
+                kill_processes( simulation );
+                return -1;
+            }
+            first_skier_id += worker_skiers;
+        }
+        return 0;
+    }
+
+    for ( int i = 0; i < skiers_amount; i++ ) {
+        // Forking thousands of skiers takes seconds, a failed one or an
+        // interrupt must not wait for all of them
+        if ( spawn_skier( i, simulation ) == -1 ||
+             ( i % SPAWN_SUPERVISION_INTERVAL == 0 &&
+               supervise( simulation ) == -1 ) ) {
+            kill_processes( simulation );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void *skibus_thread( void *arg ) {
+    skibus_thread_args_t *skibus = arg;
+    simulation_t *simulation = skibus->simulation;
+    int result = skibus_process_behavior(
+        &simulation->ski_resort, skibus->bus_idx, &simulation->journal );
+    return result == -1 ? (void *)-1 : NULL;
+}
+
+static void *skier_thread( void *arg ) {
+    skier_thread_args_t *skier = arg;
+    simulation_t *simulation = skier->simulation;
+    int result = skier_process_behavior(
+        &simulation->ski_resort, skier->skier_id, &simulation->journal );
+    return result == -1 ? (void *)-1 : NULL;
+}
+
+/// @brief Call the start off and join already created threads. They are
+/// all waiting for the start on a futex, which is no cancellation point,
+/// and return once it is called off.
+static void abort_threads( simulation_t *simulation, int skiers_created ) {
+    abort_ski_resort_start( &simulation->ski_resort );
+    for ( int i = 0; i < simulation->skibus_threads_amount; i++ ) {
+        pthread_join( simulation->skibus_threads[ i ], NULL );
+    }
+    for ( int i = 0; i < skiers_created; i++ ) {
+        pthread_join( simulation->skier_threads[ i ], NULL );
+    }
+}
+
+int spawn_threads( simulation_t *simulation ) {
+    pthread_attr_t attr;
+    if ( pthread_attr_init( &attr ) != 0 ) {
         return -1;
     }
-    if ( simulation->skibus_pid == 0 ) {
-        skibus_process_behavior( &simulation->ski_resort,
-                                 &simulation->journal );
+    size_t stack_size = THREAD_STACK_SIZE;
+    if ( stack_size < PTHREAD_STACK_MIN ) {
+        stack_size = PTHREAD_STACK_MIN;
+    }
+    if ( pthread_attr_setstacksize( &attr, stack_size ) != 0 ) {
+        pthread_attr_destroy( &attr );
+        return -1;
+    }
+
+    for ( int i = 0; i < simulation->ski_resort.buses_amount; i++ ) {
+        skibus_thread_args_t *skibus = &simulation->skibus_thread_args[ i ];
+        skibus->simulation = simulation;
+        skibus->bus_idx = i;
+
+        if ( pthread_create( &simulation->skibus_threads[ i ], &attr,
+                             skibus_thread, skibus ) != 0 ) {
+            abort_threads( simulation, 0 );
+            pthread_attr_destroy( &attr );
+            return -1;
+        }
+        simulation->skibus_threads_amount++;
     }
 
     int skiers_amount = simulation->ski_resort.skiers_amount;
     for ( int i = 0; i < skiers_amount; i++ ) {
-        if ( spawn_skier( i, simulation ) == -1 ) {
-            // Kill all processes created
-            kill( simulation->skibus_pid, SIGKILL );
-            for ( int j = 0; j < i; j++ ) {
-                pid_t skier_pid = simulation->skier_pids[ j ];
-                kill( skier_pid, SIGKILL );
-            }
+        skier_thread_args_t *skier = &simulation->skier_thread_args[ i ];
+        skier->simulation = simulation;
+        skier->skier_id = i + 1;
+
+        if ( pthread_create( &simulation->skier_threads[ i ], &attr,
+                             skier_thread, skier ) != 0 ) {
+            abort_threads( simulation, i );
+            pthread_attr_destroy( &attr );
             return -1;
         }
     }
 
+    pthread_attr_destroy( &attr );
     return 0;
 }
 
+int wait_for_threads( simulation_t *simulation ) {
+    int result = 0;
+
+    void *thread_result = NULL;
+    for ( int i = 0; i < simulation->skibus_threads_amount; i++ ) {
+        pthread_join( simulation->skibus_threads[ i ], &thread_result );
+        if ( thread_result != NULL ) {
+            (void)fprintf( stderr, "one of the skibus threads had failed\n" );
+            result = -1;
+        }
+    }
+
+    for ( int i = 0; i < simulation->ski_resort.skiers_amount; i++ ) {
+        pthread_join( simulation->skier_threads[ i ], &thread_result );
+        if ( thread_result != NULL ) {
+            (void)fprintf( stderr, "one of the skier threads had failed\n" );
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
 int allocate_resources( arguments_t *args, simulation_t *simulation ) {
-    if ( init_journal( &simulation->journal, args->output ) == -1 ) {
+    simulation->execution_mode = args->execution_mode;
+    simulation->workers_amount = args->workers_amount;
+    simulation->metrics_server.listen_fd = -1;
+    simulation->process_group = 0;
+    simulation->processes_running = 0;
+    simulation->skibus_threads_amount = 0;
+    simulation->skibus_threads = NULL;
+    simulation->skibus_thread_args = NULL;
+    simulation->skier_threads = NULL;
+    simulation->skier_thread_args = NULL;
+
+    size_t arena_size = journal_shared_size( args->journal_mode ) +
+                        ski_resort_shared_size( args ) +
+                        sync_stats_shared_size();
+    char instance_name[ SHARED_ARENA_NAME_MAX_SIZE ];
+    char *shm_name = args->shm_name;
+    if ( shm_name == NULL ) {
+        instance_shm_name( instance_name, SHM_ARENA_BASE_NAME );
+        shm_name = instance_name;
+    }
+    if ( init_shared_arena( &simulation->arena, arena_size, shm_name,
+                            args->execution_mode != EXEC_THREADS,
+                            args->huge_pages ) == -1 ) {
+        if ( errno == EEXIST ) {
+            (void)fprintf( stderr, "shared memory %s already exists\n",
+                           shm_name );
+        }
         return -1;
     }
 
-    if ( init_ski_resort( args, &simulation->ski_resort ) == -1 ) {
-        destroy_journal( &simulation->journal );
+    if ( init_sync_stats( &simulation->arena ) == -1 ) {
+        destroy_shared_arena( &simulation->arena );
         return -1;
     }
 
-    simulation->skier_pids = malloc( sizeof( pid_t ) * args->skiers_amount );
-    if ( simulation->skier_pids == NULL ) {
-        destroy_ski_resort( &simulation->ski_resort );
+    if ( init_journal( &simulation->journal, &simulation->arena,
+                       args->output, args->journal_mode,
+                       args->journal_format ) == -1 ) {
+        destroy_shared_arena( &simulation->arena );
+        return -1;
+    }
+
+    if ( init_ski_resort( args, &simulation->ski_resort,
+                          &simulation->arena ) == -1 ) {
         destroy_journal( &simulation->journal );
+        destroy_shared_arena( &simulation->arena );
+        return -1;
+    }
+
+    // Processes are supervised without any memory of their own
+    bool allocated = true;
+    if ( args->execution_mode == EXEC_THREADS ) {
+        simulation->skibus_threads =
+            malloc( sizeof( pthread_t ) * args->buses_amount );
+        simulation->skibus_thread_args =
+            malloc( sizeof( skibus_thread_args_t ) * args->buses_amount );
+        simulation->skier_threads =
+            malloc( sizeof( pthread_t ) * args->skiers_amount );
+        simulation->skier_thread_args =
+            malloc( sizeof( skier_thread_args_t ) * args->skiers_amount );
+        allocated = simulation->skibus_threads != NULL &&
+                    simulation->skibus_thread_args != NULL &&
+                    simulation->skier_threads != NULL &&
+                    simulation->skier_thread_args != NULL;
+    }
+
+    if ( !allocated ) {
+        free_resources( simulation );
         return -1;
     }
     return 0;
 }
 
 void free_resources( simulation_t *simulation ) {
-    free( simulation->skier_pids );
+    stop_metrics_server( &simulation->metrics_server );
+    free( simulation->skibus_threads );
+    free( simulation->skibus_thread_args );
+    free( simulation->skier_threads );
+    free( simulation->skier_thread_args );
     destroy_ski_resort( &simulation->ski_resort );
     destroy_journal( &simulation->journal );
+    destroy_shared_arena( &simulation->arena );
 }
@@ -9,181 +9,221 @@
 #include <unistd.h>
 
 #include "../include/dbg.h"
+#include "../include/futex_sync.h"
 #include "../include/journal.h"
+#include "../include/metrics.h"
 #include "../include/random.h"
+#include "../include/route.h"
 #include "../include/sharing.h"
-
-#define SHM_SKI_RESORT_START_LOCK_NAME "/ski_resort_start_lock"
-#define SHM_SKI_RESORT_STOPS_NAME "/ski_resort_stops"
-
-#define SHM_SKIBUS_IN_DONE_NAME "/skibus_in_done"
-#define SHM_SKIBUS_OUT_NAME "/skibus_out"
-#define SHM_SKIBUS_OUT_DONE_NAME "/skibus_out_done"
-
-#define SHM_BUS_STOP_ENTER_FORMAT "/bus_stop_%i_enter"
-#define SHM_BUS_STOP_WAIT_FORMAT "/bus_stop_%i"
-#define SHM_BUS_STOP_COUNTER_FORMAT "/bus_stop_%i_counter"
-
-enum { SHM_NAME_MAX_SIZE = 30 };
+#include "../include/stop_bitmap.h"
+#include "../include/sync_stats.h"
 
 // Helper functions to initialize a program
-static int init_skibus( skibus_t *bus, arguments_t *args );
-static void destroy_skibus( skibus_t *bus );
-static int init_bus_stop( bus_stop_t *stop, int stop_idx );
-static void destroy_bus_stop( bus_stop_t *stop, int stop_idx );
+static void init_skibus( skibus_t *bus, int bus_idx, arguments_t *args,
+                         shared_arena_t *arena );
+static int init_bus_stop( bus_stop_t *stop, shared_arena_t *arena );
+static void destroy_bus_stop( bus_stop_t *stop );
 
 // Helper functions to run the skibus process
-static void let_passengers_out( ski_resort_t *resort );
-static void board_passengers( ski_resort_t *resort, int stop_idx );
-static void drive_skibus( ski_resort_t *resort, journal_t *journal );
-
-static int init_skibus( skibus_t *bus, arguments_t *args ) {
+static void let_passengers_out( ski_resort_t *resort, skibus_t *bus );
+static void board_passengers( ski_resort_t *resort, skibus_t *bus,
+                              int stop_idx );
+static void drive_skibus( ski_resort_t *resort, skibus_t *bus,
+                          journal_t *journal, rand_stream_t *random );
+
+static void init_skibus( skibus_t *bus, int bus_idx, arguments_t *args,
+                         shared_arena_t *arena ) {
+    bus->bus_idx = bus_idx;
+    bus->journal_id = args->label_buses ? bus_idx + 1 : 0;
     bus->capacity = args->bus_capacity;
     bus->capacity_taken = 0;
-    bus->max_ride_to_stop_time = args->max_ride_to_stop_time;
+    bus->position = 0;
 
-    int result =
-        init_semaphore( &bus->sem_in_done, 0, SHM_SKIBUS_IN_DONE_NAME );
-    if ( result == -1 ) {
-        return -1;
-    }
+    init_futex_latch( &bus->boarding_done, arena->process_shared );
+    init_futex_handoff( &bus->get_out, arena->process_shared );
+    init_futex_latch( &bus->unloading_done, arena->process_shared );
+}
+
+static int init_bus_stop( bus_stop_t *stop, shared_arena_t *arena ) {
+    stop->waiting_skiers_amount = 0;
+    stop->skiers_en_route = 0;
+    stop->boarding_bus = 0;
+    stop->first_ticket = 0;
+    stop->tickets_issued = 0;
+    stop->tickets_admitted = 0;
+    stop->passes = 0;
 
-    result = init_semaphore( &bus->sem_out, 0, SHM_SKIBUS_OUT_NAME );
-    if ( result == -1 ) {
-        destroy_semaphore( &bus->sem_in_done, SHM_SKIBUS_IN_DONE_NAME );
+    if ( sem_init( &stop->enter_stop_lock, arena->process_shared, 1 ) == -1 ) {
         return -1;
     }
-
-    result = init_semaphore( &bus->sem_out_done, 0, SHM_SKIBUS_OUT_DONE_NAME );
-    if ( result == -1 ) {
-        destroy_semaphore( &bus->sem_in_done, SHM_SKIBUS_OUT_NAME );
-        destroy_semaphore( &bus->sem_in_done, SHM_SKIBUS_IN_DONE_NAME );
+    if ( sem_init( &stop->bay_lock, arena->process_shared, 1 ) == -1 ) {
+        sem_destroy( &stop->enter_stop_lock );
         return -1;
     }
 
     return 0;
 }
 
-static void destroy_skibus( skibus_t *bus ) {
-    if ( bus == NULL ) {
-        return;
+static void destroy_bus_stop( bus_stop_t *stop ) {
+    sem_destroy( &stop->enter_stop_lock );
+    sem_destroy( &stop->bay_lock );
+}
+
+/// @brief Count skiers walking to every stop, mark the stops they walk to in
+/// `stops_with_demand` and give every stop a range of tickets for them.
+/// Skiers are planned the same way they plan themselves.
+static void plan_demand( ski_resort_t *resort ) {
+    for ( int skier_id = 1; skier_id <= resort->skiers_amount; skier_id++ ) {
+        int bus_stop_id = 0;
+        int time_to_stop = 0;
+        plan_skier( resort, skier_id, &bus_stop_id, &time_to_stop );
+        resort->stops[ bus_stop_id - 1 ].skiers_en_route++;
+        stop_bitmap_add( &resort->stops_with_demand, bus_stop_id - 1 );
     }
 
-    destroy_semaphore( &bus->sem_in_done, SHM_SKIBUS_IN_DONE_NAME );
-    destroy_semaphore( &bus->sem_out, SHM_SKIBUS_OUT_NAME );
-    destroy_semaphore( &bus->sem_out_done, SHM_SKIBUS_OUT_DONE_NAME );
+    int first_ticket = 0;
+    for ( int i = 0; i < resort->stops_amount; i++ ) {
+        resort->stops[ i ].first_ticket = first_ticket;
+        first_ticket += resort->stops[ i ].skiers_en_route;
+    }
 }
 
-static int init_bus_stop( bus_stop_t *stop, int stop_idx ) {
-    char shm_enter_name[ SHM_NAME_MAX_SIZE + 1 ];
-    char shm_wait_name[ SHM_NAME_MAX_SIZE + 1 ];
-    char shm_counter_name[ SHM_NAME_MAX_SIZE + 1 ];
-    if ( sprintf( shm_enter_name, SHM_BUS_STOP_ENTER_FORMAT, stop_idx ) < 0 ) {
-        return -1;
+/// @brief Remove the stop from `stops_with_demand` once nobody waits at it
+/// nor walks to it. Must be called while holding its `enter_stop_lock`.
+static void update_demand( ski_resort_t *resort, int stop_idx ) {
+    bus_stop_t *bus_stop = &resort->stops[ stop_idx ];
+    if ( bus_stop->waiting_skiers_amount == 0 &&
+         bus_stop->skiers_en_route == 0 ) {
+        stop_bitmap_remove( &resort->stops_with_demand, stop_idx );
     }
-    if ( sprintf( shm_wait_name, SHM_BUS_STOP_WAIT_FORMAT, stop_idx ) < 0 ) {
+}
+
+size_t ski_resort_shared_size( arguments_t *args ) {
+    size_t counter_size = shared_object_size( sizeof( int ) );
+    size_t event_size = shared_object_size( sizeof( futex_event_t ) );
+    size_t barrier_size = shared_object_size( sizeof( futex_barrier_t ) );
+    size_t clock_size = shared_object_size( sizeof( uint64_t ) );
+
+    // Synchronization objects are embedded in the skibuses and stops
+    size_t stops_size = shared_object_size( sizeof( bus_stop_t ) *
+                                            (size_t)args->stops_amount );
+    size_t buses_size = shared_object_size( sizeof( skibus_t ) *
+                                            (size_t)args->buses_amount );
+    size_t bitmap_size = shared_object_size(
+        sizeof( uint64_t ) * stop_bitmap_words( args->stops_amount ) );
+    size_t tickets_size = shared_object_size( sizeof( stop_ticket_t ) *
+                                              (size_t)args->skiers_amount );
+
+    return barrier_size + event_size + counter_size + clock_size + buses_size +
+           stops_size + bitmap_size + tickets_size +
+           metrics_shared_size( args->stops_amount );
+}
+
+int init_ski_resort( arguments_t *args, ski_resort_t *resort,
+                     shared_arena_t *arena ) {
+    resort->skiers_amount = args->skiers_amount;
+    resort->skiers_at_resort = NULL;
+    resort->finished_at_ns = NULL;
+    resort->max_walk_to_stop_time = args->max_walk_to_stop_time;
+    resort->buses_amount = args->buses_amount;
+    resort->buses = NULL;
+    resort->stops_amount = args->stops_amount;
+    resort->route = args->route;
+    resort->stops = NULL;
+    resort->tickets = NULL;
+    resort->start = NULL;
+    resort->everyone_at_resort = NULL;
+    resort->skip_empty_stops = args->skip_empty_stops;
+
+    size_t stops_size = sizeof( bus_stop_t ) * resort->stops_amount;
+    if ( init_shared_var( arena, (void **)&resort->stops, stops_size ) ==
+         -1 ) {
         return -1;
     }
-    if ( sprintf( shm_counter_name, SHM_BUS_STOP_COUNTER_FORMAT, stop_idx ) <
-         0 ) {
+    size_t buses_size = sizeof( skibus_t ) * resort->buses_amount;
+    if ( init_shared_var( arena, (void **)&resort->buses, buses_size ) ==
+         -1 ) {
+        resort->stops = NULL;
         return -1;
     }
 
-    // Configure skiers counter
-    if ( init_shared_var( (void **)&stop->waiting_skiers_amount, sizeof( int ),
-                          shm_counter_name ) == -1 ) {
+    if ( init_shared_var( arena, (void **)&resort->skiers_at_resort,
+                          sizeof( int ) ) == -1 ) {
+        destroy_ski_resort( resort );
         return -1;
     }
-    *( stop->waiting_skiers_amount ) = 0;
+    *resort->skiers_at_resort = 0;
 
-    if ( init_semaphore( &stop->enter_stop_lock, 1, shm_enter_name ) == -1 ) {
-        destroy_shared_var( (void **)&stop->waiting_skiers_amount,
-                            sizeof( int ), shm_counter_name );
+    if ( init_shared_var( arena, (void **)&resort->finished_at_ns,
+                          sizeof( uint64_t ) ) == -1 ) {
+        destroy_ski_resort( resort );
         return -1;
     }
+    *resort->finished_at_ns = 0;
 
-    if ( init_semaphore( &stop->enter_bus_lock, 0, shm_wait_name ) == -1 ) {
-        destroy_semaphore( &stop->enter_stop_lock, shm_wait_name );
-        destroy_shared_var( (void **)&stop->waiting_skiers_amount,
-                            sizeof( int ), shm_counter_name );
+    if ( init_shared_var( arena, (void **)&resort->start,
+                          sizeof( futex_barrier_t ) ) == -1 ) {
+        destroy_ski_resort( resort );
         return -1;
     }
-
-    return 0;
-}
-
-static void destroy_bus_stop( bus_stop_t *stop, int stop_idx ) {
-    if ( stop == NULL ) {
-        return;
-    }
-
-    char shm_enter_name[ SHM_NAME_MAX_SIZE + 1 ];
-    char shm_wait_name[ SHM_NAME_MAX_SIZE + 1 ];
-    char shm_counter_name[ SHM_NAME_MAX_SIZE + 1 ];
-    if ( sprintf( shm_enter_name, SHM_BUS_STOP_ENTER_FORMAT, stop_idx ) < 0 ) {
-        return;
-    }
-    if ( sprintf( shm_wait_name, SHM_BUS_STOP_WAIT_FORMAT, stop_idx ) < 0 ) {
-        return;
+    // Skier workers wait for the start instead of their skiers
+    int skier_parties = args->execution_mode == EXEC_WORKERS
+                            ? args->workers_amount
+                            : args->skiers_amount;
+    init_futex_barrier( resort->start, resort->buses_amount + skier_parties,
+                        arena->process_shared );
+
+    if ( init_shared_var( arena, (void **)&resort->everyone_at_resort,
+                          sizeof( futex_event_t ) ) == -1 ) {
+        destroy_ski_resort( resort );
+        return -1;
     }
-    if ( sprintf( shm_counter_name, SHM_BUS_STOP_COUNTER_FORMAT, stop_idx ) <
-         0 ) {
-        return;
+    init_futex_event( resort->everyone_at_resort, arena->process_shared );
+
+    uint64_t *bitmap_words = NULL;
+    size_t bitmap_size =
+        sizeof( uint64_t ) * stop_bitmap_words( resort->stops_amount );
+    if ( init_shared_var( arena, (void **)&bitmap_words, bitmap_size ) ==
+         -1 ) {
+        destroy_ski_resort( resort );
+        return -1;
     }
-
-    destroy_shared_var( (void **)&stop->waiting_skiers_amount, sizeof( int ),
-                        shm_counter_name );
-
-    destroy_semaphore( &stop->enter_stop_lock, shm_enter_name );
-    destroy_semaphore( &stop->enter_bus_lock, shm_wait_name );
-}
-
-int init_ski_resort( arguments_t *args, ski_resort_t *resort ) {
-    resort->skiers_amount = args->skiers_amount;
-    resort->skiers_at_resort = 0;
-    resort->max_walk_to_stop_time = args->max_walk_to_stop_time;
-    resort->stops_amount = args->stops_amount;
-
-    size_t stops_size = sizeof( bus_stop_t ) * resort->stops_amount;
-    if ( init_shared_var( (void **)&resort->stops, stops_size,
-                          SHM_SKI_RESORT_STOPS_NAME ) == -1 ) {
+    init_stop_bitmap( &resort->stops_with_demand, bitmap_words,
+                      resort->stops_amount );
+
+    size_t tickets_size =
+        sizeof( stop_ticket_t ) * (size_t)resort->skiers_amount;
+    if ( init_shared_var( arena, (void **)&resort->tickets, tickets_size ) ==
+         -1 ) {
+        destroy_ski_resort( resort );
         return -1;
     }
+    for ( int i = 0; i < resort->skiers_amount; i++ ) {
+        init_futex_gate( &resort->tickets[ i ].enter_bus,
+                         arena->process_shared );
+    }
 
-    if ( init_semaphore( &resort->start_lock, 0,
-                         SHM_SKI_RESORT_START_LOCK_NAME ) == -1 ) {
-        destroy_shared_var( (void **)&resort->stops, stops_size,
-                            SHM_SKI_RESORT_STOPS_NAME );
+    if ( init_metrics( &resort->metrics, arena, resort->stops_amount,
+                       args->bus_capacity ) == -1 ) {
+        destroy_ski_resort( resort );
         return -1;
     }
 
-    if ( init_skibus( &resort->bus, args ) == -1 ) {
-        destroy_semaphore( &resort->start_lock,
-                           SHM_SKI_RESORT_START_LOCK_NAME );
-        destroy_shared_var( (void **)&resort->stops, stops_size,
-                            SHM_SKI_RESORT_STOPS_NAME );
-        return -1;
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        init_skibus( &resort->buses[ i ], i, args, arena );
     }
     int stop_id = 0;
     while ( stop_id < resort->stops_amount ) {
-        int stop_idx = stop_id + 1;
-        bus_stop_t bus_stop;
-        if ( init_bus_stop( &bus_stop, stop_idx ) == -1 ) {
-            // Destroy already allocated bus stops
-            for ( int i = 0; i < stop_id; i++ ) {
-                destroy_bus_stop( &resort->stops[ i ], i );
-            }
-
-            destroy_skibus( &resort->bus );
-            destroy_semaphore( &resort->start_lock,
-                               SHM_SKI_RESORT_START_LOCK_NAME );
-            destroy_shared_var( (void **)&resort->stops, stops_size,
-                                SHM_SKI_RESORT_STOPS_NAME );
+        bus_stop_t *bus_stop = &resort->stops[ stop_id ];
+        if ( init_bus_stop( bus_stop, arena ) == -1 ) {
+            // Destroy already initialized bus stops only
+            resort->stops_amount = stop_id;
+            destroy_ski_resort( resort );
             return -1;
         }
-        resort->stops[ stop_id ] = bus_stop;
         stop_id++;
     }
+    plan_demand( resort );
 
     return 0;
 }
@@ -192,164 +232,339 @@ int start_ski_resort( ski_resort_t *resort ) {
     if ( resort == NULL ) {
         return -1;
     }
-    if ( sem_post( resort->start_lock ) == -1 ) {
-        return -1;
-    }
+    futex_barrier_release( resort->start );
     return 0;
 }
 
+bool try_start_ski_resort( ski_resort_t *resort, long long timeout_ns ) {
+    return futex_barrier_release_timed( resort->start, timeout_ns );
+}
+
+void abort_ski_resort_start( ski_resort_t *resort ) {
+    futex_barrier_abort( resort->start );
+}
+
 void destroy_ski_resort( ski_resort_t *resort ) {
     if ( resort == NULL ) {
         return;
     }
 
-    destroy_semaphore( &resort->start_lock, SHM_SKI_RESORT_START_LOCK_NAME );
-    destroy_skibus( &resort->bus );
+    // Futexes need no cleanup, they go away with the arena
+    resort->start = NULL;
+    resort->everyone_at_resort = NULL;
+    resort->stops_with_demand.words = NULL;
+    resort->tickets = NULL;
+    resort->buses = NULL;
 
+    if ( resort->stops == NULL ) {
+        return;
+    }
     int stop_id = 0;
     while ( stop_id < resort->stops_amount ) {
-        int stop_idx = stop_id + 1;
-        destroy_bus_stop( &resort->stops[ stop_id ], stop_idx );
+        destroy_bus_stop( &resort->stops[ stop_id ] );
         stop_id++;
     }
-
-    size_t stops_size = sizeof( bus_stop_t ) * resort->stops_amount;
-    destroy_shared_var( (void **)&resort->stops, stops_size,
-                        SHM_SKI_RESORT_STOPS_NAME );
+    resort->stops = NULL;
 }
 
-static void let_passengers_out( ski_resort_t *resort ) {
-    loginfo( "bus has %i passengers", resort->bus.capacity_taken );
-    while ( resort->bus.capacity_taken > 0 ) {
-        // Allow 1 skier out
-        sem_post( resort->bus.sem_out );
-        // Wait for 1 skier to get out
-        sem_wait( resort->bus.sem_out_done );
-        resort->skiers_at_resort++;
-        resort->bus.capacity_taken--;
+static void let_passengers_out( ski_resort_t *resort, skibus_t *bus ) {
+    loginfo( "bus %i has %i passengers", bus->bus_idx, bus->capacity_taken );
+    if ( bus->capacity_taken == 0 ) {
+        return;
+    }
+
+    // Open the door for everyone. The last skier to get out reports that the
+    // bus is empty.
+    futex_latch_arm( &bus->unloading_done, bus->capacity_taken );
+    futex_handoff_grant( &bus->get_out, bus->capacity_taken );
+    timed_wait( SYNC_UNLOADING_DONE,
+                futex_latch_wait( &bus->unloading_done ) );
+
+    int skiers_at_resort =
+        __atomic_add_fetch( resort->skiers_at_resort, bus->capacity_taken,
+                            __ATOMIC_ACQ_REL );
+    if ( skiers_at_resort == resort->skiers_amount ) {
+        futex_event_set( resort->everyone_at_resort );
     }
+    __atomic_store_n( &bus->capacity_taken, 0, __ATOMIC_RELAXED );
 }
 
-static void board_passengers( ski_resort_t *resort, int stop_idx ) {
+static void board_passengers( ski_resort_t *resort, skibus_t *bus,
+                              int stop_idx ) {
     bus_stop_t *bus_stop = &resort->stops[ stop_idx ];
 
-    while ( true ) {
-        // Get the amount of waiting skiers
-        sem_wait( bus_stop->enter_stop_lock );
-        bool has_skiers_waiting = *bus_stop->waiting_skiers_amount > 0;
+    // Another skibus may be boarding at the stop
+    timed_sem_wait( &bus_stop->bay_lock, SYNC_BAY_LOCK );
+    bus_stop->boarding_bus = bus->bus_idx;
 
-        bool can_fit_more_skiers =
-            resort->bus.capacity > resort->bus.capacity_taken;
+    // Skiers may keep arriving while the previous batch is boarding
+    while ( true ) {
+        // Take as many waiting skiers as fit into the bus at once
+        timed_sem_wait( &bus_stop->enter_stop_lock, SYNC_ENTER_STOP_LOCK );
+        int free_seats = bus->capacity - bus->capacity_taken;
+        int batch_size = bus_stop->waiting_skiers_amount;
+        if ( batch_size > free_seats ) {
+            batch_size = free_seats;
+        }
+        bus_stop->waiting_skiers_amount -= batch_size;
+        update_demand( resort, stop_idx );
 
-        loginfo( "capacity_taken:%i, waiting_skiers:%i, left_to_drive:%i",
-                 resort->bus.capacity_taken, *bus_stop->waiting_skiers_amount,
-                 resort->skiers_amount - resort->skiers_at_resort );
+        loginfo( "capacity_taken:%i, waiting_skiers:%i", bus->capacity_taken,
+                 bus_stop->waiting_skiers_amount );
 
-        sem_post( bus_stop->enter_stop_lock );
+        sem_post( &bus_stop->enter_stop_lock );
 
-        if ( !can_fit_more_skiers || !has_skiers_waiting ) {
+        if ( batch_size == 0 ) {
             break;
         }
 
-        // Let 1 skier in
-        sem_post( bus_stop->enter_bus_lock );
-        sem_wait( resort->bus.sem_in_done );
+        // Let the whole batch in, the skiers who arrived first. The last
+        // skier to board reports that the batch is done.
+        futex_latch_arm( &bus->boarding_done, batch_size );
+        stop_ticket_t *tickets =
+            &resort->tickets[ bus_stop->first_ticket +
+                              bus_stop->tickets_admitted ];
+        for ( int i = 0; i < batch_size; i++ ) {
+            futex_gate_open( &tickets[ i ].enter_bus );
+        }
+        bus_stop->tickets_admitted += batch_size;
+        timed_wait( SYNC_BOARDING_DONE,
+                    futex_latch_wait( &bus->boarding_done ) );
 
-        loginfo( "BUS: skier got in. Updating info..." );
+        loginfo( "BUS %i: %i skiers got in", bus->bus_idx, batch_size );
 
-        // Confirm that skier got into the bus
-        sem_wait( bus_stop->enter_stop_lock );
-        ( *bus_stop->waiting_skiers_amount )--;
-        sem_post( bus_stop->enter_stop_lock );
+        __atomic_store_n( &bus->capacity_taken,
+                          bus->capacity_taken + batch_size, __ATOMIC_RELAXED );
+    }
 
-        resort->bus.capacity_taken++;
+    __atomic_add_fetch( &bus_stop->passes, 1, __ATOMIC_RELAXED );
+    sem_post( &bus_stop->bay_lock );
+}
+
+/// @brief Stop the skibus drives to from `stop_idx` on. Every stop, unless
+/// it skips those nobody waits at nor walks to.
+/// @return `stops_amount` if it drives to the final stop.
+static int next_stop( ski_resort_t *resort, skibus_t *bus, int stop_idx ) {
+    if ( !resort->skip_empty_stops ) {
+        return stop_idx;
+    }
+    // A full skibus has nothing to stop for
+    if ( bus->capacity_taken == bus->capacity ) {
+        return resort->stops_amount;
     }
+    return stop_bitmap_next( &resort->stops_with_demand, stop_idx );
 }
 
-static void drive_skibus( ski_resort_t *resort, journal_t *journal ) {
-    skibus_t *bus = &resort->bus;
+static void skip_stops( ski_resort_t *resort, int from_idx, int to_idx ) {
+    for ( int i = from_idx; i < to_idx; i++ ) {
+        __atomic_add_fetch( &resort->stops[ i ].passes, 1, __ATOMIC_RELAXED );
+        metrics_add_stop_skip( &resort->metrics, i );
+    }
+}
 
-    // Ride through every bus stop
-    for ( int i = 0; i < resort->stops_amount; i++ ) {
+static void drive_skibus( ski_resort_t *resort, skibus_t *bus,
+                          journal_t *journal, rand_stream_t *random ) {
+    // Ride through the bus stops in order
+    int i = next_stop( resort, bus, 0 );
+    skip_stops( resort, 0, i );
+    // First segment of the ride to the next stop
+    int segment_idx = 0;
+    while ( i < resort->stops_amount ) {
         int stop_id = i + 1;
 
-        // Get to the bus stop
-        int time_to_next_stop = rand_number( bus->max_ride_to_stop_time );
-        usleep( time_to_next_stop );
-        journal_bus_arrived( journal, stop_id );
+        // Get to the bus stop, past any skipped ones
+        __atomic_store_n( &bus->position, stop_id, __ATOMIC_RELAXED );
+        usleep( route_ride_time( resort->route, segment_idx, i, random ) );
+        journal_bus_arrived( journal, bus->journal_id, stop_id );
 
         loginfo( "boarding passengers at stop %i", stop_id );
-        board_passengers( resort, i );
+        board_passengers( resort, bus, i );
         loginfo( "passengers at stop %i were boarded", stop_id );
+        metrics_add_stop_visit( &resort->metrics, i, bus->capacity_taken );
+
+        journal_bus_leaving( journal, bus->journal_id, stop_id );
 
-        journal_bus_leaving( journal, stop_id );
+        int next_stop_idx = next_stop( resort, bus, i + 1 );
+        skip_stops( resort, i + 1, next_stop_idx );
+        segment_idx = i + 1;
+        i = next_stop_idx;
     }
 
-    journal_bus( journal, "arrived to final" );
+    __atomic_store_n( &bus->position, 0, __ATOMIC_RELAXED );
+    journal_bus( journal, bus->journal_id, JOURNAL_ARRIVED_TO_FINAL );
 
-    let_passengers_out( resort );
+    metrics_add_trip( &resort->metrics, bus->capacity_taken );
+    let_passengers_out( resort, bus );
 
-    journal_bus( journal, "leaving final" );
+    journal_bus( journal, bus->journal_id, JOURNAL_LEAVING_FINAL );
+}
+
+/// @brief Remember when the skibus finished, if it is the last one so far.
+static void mark_finished( ski_resort_t *resort ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    uint64_t now_ns =
+        (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+    uint64_t finished_at =
+        __atomic_load_n( resort->finished_at_ns, __ATOMIC_RELAXED );
+    while ( finished_at < now_ns &&
+            !__atomic_compare_exchange_n( resort->finished_at_ns, &finished_at,
+                                          now_ns, false, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) ) {
+    }
 }
 
-void skibus_process_behavior( ski_resort_t *resort, journal_t *journal ) {
+int skibus_process_behavior( ski_resort_t *resort, int bus_idx,
+                             journal_t *journal ) {
+    skibus_t *bus = &resort->buses[ bus_idx ];
+    rand_stream_t random;
+    init_rand_stream( &random, RAND_STREAM_SKIBUS( bus_idx ) );
+
     // Wait for start signal
-    sem_wait( resort->start_lock );
-    sem_post( resort->start_lock );
+    if ( !wait_for_start( resort ) ) {
+        return 0;
+    }
 
-    journal_bus( journal, "started" );
+    journal_bus( journal, bus->journal_id, JOURNAL_STARTED );
+    metrics_add_start( &resort->metrics, metrics_clock() );
 
+    // Every skibus rides until the whole fleet has taken everyone
     bool ride_again = true;
     while ( ride_again ) {
-        drive_skibus( resort, journal );
-        loginfo( "skiers at the resort: %i", resort->skiers_at_resort );
+        bool nothing_to_pick_up =
+            resort->skip_empty_stops &&
+            stop_bitmap_next( &resort->stops_with_demand, 0 ) ==
+                resort->stops_amount;
+        if ( !nothing_to_pick_up ) {
+            drive_skibus( resort, bus, journal, &random );
+        } else if ( __atomic_load_n( resort->skiers_at_resort,
+                                     __ATOMIC_ACQUIRE ) <
+                    resort->skiers_amount ) {
+            // The rest of the skiers are on board of other skibuses
+            timed_wait( SYNC_EVERYONE_AT_RESORT,
+                        futex_event_wait( resort->everyone_at_resort ) );
+        }
+        int skiers_at_resort =
+            __atomic_load_n( resort->skiers_at_resort, __ATOMIC_ACQUIRE );
+        loginfo( "skiers at the resort: %i", skiers_at_resort );
 
-        if ( resort->skiers_at_resort == resort->skiers_amount ) {
+        if ( skiers_at_resort == resort->skiers_amount ) {
             ride_again = false;
-        } else if ( resort->skiers_at_resort > resort->skiers_amount ) {
+        } else if ( skiers_at_resort > resort->skiers_amount ) {
             (void)fprintf( stderr, "there are more skiers at the resort than "
                                    "initially existed\n" );
-            exit( EXIT_FAILURE );
+            return -1;
         }
     }
 
-    journal_bus( journal, "finish" );
-    exit( EXIT_SUCCESS );
+    journal_bus( journal, bus->journal_id, JOURNAL_FINISH );
+    mark_finished( resort );
+    return 0;
+}
+
+bool wait_for_start( ski_resort_t *resort ) {
+    bool started = false;
+    timed_wait( SYNC_START,
+                started = futex_barrier_arrive_and_wait( resort->start ) );
+    return started;
+}
+
+void plan_skier( ski_resort_t *resort, int skier_id, int *bus_stop_id,
+                 int *time_to_stop ) {
+    rand_stream_t random;
+    init_rand_stream( &random, (uint64_t)skier_id );
+    *bus_stop_id = rand_number( &random, resort->stops_amount );
+    *time_to_stop = rand_number( &random, resort->max_walk_to_stop_time );
+}
+
+stop_ticket_t *skier_arrive_at_stop( ski_resort_t *resort, int skier_id,
+                                     int bus_stop_id, uint64_t *since,
+                                     journal_t *journal ) {
+    bus_stop_t *bus_stop = &resort->stops[ bus_stop_id - 1 ];
+    uint64_t now = metrics_clock();
+    metrics_add_walk( &resort->metrics, now - *since );
+    *since = now;
+
+    timed_sem_wait( &bus_stop->enter_stop_lock, SYNC_ENTER_STOP_LOCK );
+    stop_ticket_t *ticket =
+        &resort->tickets[ bus_stop->first_ticket + bus_stop->tickets_issued ];
+    bus_stop->tickets_issued++;
+    ticket->passes_at_arrival =
+        __atomic_load_n( &bus_stop->passes, __ATOMIC_RELAXED );
+    bus_stop->waiting_skiers_amount++;
+    bus_stop->skiers_en_route--;
+    loginfo( "L: %i entered stop %i", skier_id, bus_stop_id );
+    sem_post( &bus_stop->enter_stop_lock );
+    journal_skier_arrived_to_stop( journal, skier_id, bus_stop_id );
+    return ticket;
+}
+
+int skier_board( ski_resort_t *resort, int skier_id, int bus_stop_id,
+                 stop_ticket_t *ticket, uint64_t *since, journal_t *journal ) {
+    // The skibus holds the bay until its whole batch has boarded
+    bus_stop_t *bus_stop = &resort->stops[ bus_stop_id - 1 ];
+    int bus_idx = bus_stop->boarding_bus;
+    skibus_t *bus = &resort->buses[ bus_idx ];
+
+    loginfo( "L: %i entered bus %i", skier_id, bus_idx );
+    uint64_t now = metrics_clock();
+    metrics_add_boarding( &resort->metrics, bus_stop_id - 1, now - *since );
+    // The boarding skibus has not left yet
+    metrics_add_passes_waited(
+        &resort->metrics,
+        __atomic_load_n( &bus_stop->passes, __ATOMIC_RELAXED ) -
+            ticket->passes_at_arrival );
+    *since = now;
+    // Journal before the bus may leave the stop
+    journal_skier_boarding( journal, skier_id );
+    futex_latch_count_down( &bus->boarding_done );
+    return bus_idx;
+}
+
+void skier_get_out( ski_resort_t *resort, int bus_idx, int skier_id,
+                    uint64_t *since, journal_t *journal ) {
+    skibus_t *bus = &resort->buses[ bus_idx ];
+    uint64_t now = metrics_clock();
+    metrics_add_ride( &resort->metrics, now - *since );
+    *since = now;
+
+    // Journal before the bus may leave the final stop
+    journal_skier_going_to_ski( journal, skier_id );
+    futex_latch_count_down( &bus->unloading_done );
 }
 
-void skier_process_behavior( ski_resort_t *resort, int skier_id,
-                             int bus_stop_id, journal_t *journal ) {
-    int bus_stop_idx = bus_stop_id - 1;
-    bus_stop_t *bus_stop = &resort->stops[ bus_stop_idx ];
-    int time_to_stop = rand_number( resort->max_walk_to_stop_time );
+int skier_process_behavior( ski_resort_t *resort, int skier_id,
+                            journal_t *journal ) {
+    int bus_stop_id = 0;
+    int time_to_stop = 0;
+    plan_skier( resort, skier_id, &bus_stop_id, &time_to_stop );
 
     // Wait for start signal
-    sem_wait( resort->start_lock );
-    sem_post( resort->start_lock );
-    journal_skier( journal, skier_id, "started" );
+    if ( !wait_for_start( resort ) ) {
+        return 0;
+    }
+    journal_skier( journal, skier_id, JOURNAL_STARTED );
+    uint64_t since = metrics_clock();
+    metrics_add_skier_start( &resort->metrics, since );
 
     // Walk to the bus stop
     usleep( time_to_stop );
 
-    // Arrive at the bus stop
-    sem_wait( bus_stop->enter_stop_lock );
-    ( *bus_stop->waiting_skiers_amount )++;
-    loginfo( "L: %i entered stop %i", skier_id, bus_stop_id );
-    sem_post( bus_stop->enter_stop_lock );
-    journal_skier_arrived_to_stop( journal, skier_id, bus_stop_id );
+    stop_ticket_t *ticket =
+        skier_arrive_at_stop( resort, skier_id, bus_stop_id, &since, journal );
 
     // Wait for bus to open door at the bus stop to get in it.
-    sem_wait( bus_stop->enter_bus_lock );
-    loginfo( "L: %i entered bus", skier_id );
-    sem_post( resort->bus.sem_in_done );
-    journal_skier_boarding( journal, skier_id );
+    timed_wait( SYNC_ENTER_BUS, futex_gate_wait( &ticket->enter_bus ) );
+    int bus_idx =
+        skier_board( resort, skier_id, bus_stop_id, ticket, &since, journal );
 
     // Wait for bus to arrive at the resort & let him out
-    sem_wait( resort->bus.sem_out );
-    sem_post( resort->bus.sem_out_done );
-    journal_skier_going_to_ski( journal, skier_id );
+    timed_wait( SYNC_GET_OUT,
+                futex_handoff_take( &resort->buses[ bus_idx ].get_out ) );
+    skier_get_out( resort, bus_idx, skier_id, &since, journal );
 
     loginfo( "L: %i is finishing execution %i", skier_id, bus_stop_id );
 
-    exit( EXIT_SUCCESS );
+    return 0;
 }
@@ -0,0 +1,334 @@
+#include "../include/skier_worker.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/dbg.h"
+#include "../include/futex_sync.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/ski_resort.h"
+
+// How long an idle worker blocks on one handoff or ticket before it checks
+// the others it waits on
+enum { IDLE_POLL_NS = 200 * 1000 };
+
+enum { NS_PER_US = 1000, NS_PER_S = 1000 * 1000 * 1000 };
+
+struct worker_skier {
+    int skier_id;
+    int bus_stop_id;
+    int time_to_stop;
+    long long arrive_at_ns;
+    // When the skier's last step was done, see `metrics_clock()`
+    uint64_t since;
+    // Place in the queue at the stop, once arrived
+    stop_ticket_t *ticket;
+    // Next skier in the same queue, -1 if last
+    int next;
+};
+typedef struct worker_skier worker_skier_t;
+
+/// @brief FIFO of skiers linked through `worker_skier_t.next`.
+struct skier_queue {
+    int first;
+    int last;
+};
+typedef struct skier_queue skier_queue_t;
+
+struct skier_worker {
+    ski_resort_t *resort;
+    journal_t *journal;
+
+    worker_skier_t *skiers;
+    int skiers_amount;
+
+    // Timer queue of walking skiers. Every walk is known once the skiers
+    // start, so it is a sorted array consumed from the front.
+    int *walking;
+    int walking_next;
+
+    // Skiers waiting at each bus stop
+    skier_queue_t *waiting;
+    int waiting_amount;
+
+    // Passengers of each skibus
+    skier_queue_t *in_bus;
+    int in_bus_amount;
+    int at_resort;
+};
+typedef struct skier_worker skier_worker_t;
+
+static long long monotonic_ns( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * NS_PER_S + now.tv_nsec;
+}
+
+static void queue_push( skier_worker_t *worker, skier_queue_t *queue,
+                        int skier_idx ) {
+    worker->skiers[ skier_idx ].next = -1;
+    if ( queue->last == -1 ) {
+        queue->first = skier_idx;
+    } else {
+        worker->skiers[ queue->last ].next = skier_idx;
+    }
+    queue->last = skier_idx;
+}
+
+static int queue_pop( skier_worker_t *worker, skier_queue_t *queue ) {
+    int skier_idx = queue->first;
+    queue->first = worker->skiers[ skier_idx ].next;
+    if ( queue->first == -1 ) {
+        queue->last = -1;
+    }
+    return skier_idx;
+}
+
+static bool queue_is_empty( skier_queue_t *queue ) {
+    return queue->first == -1;
+}
+
+// Used to sort the timer queue
+static skier_worker_t *sorted_worker = NULL;
+
+static int compare_arrivals( const void *a, const void *b ) {
+    long long arrive_a = sorted_worker->skiers[ *(const int *)a ].arrive_at_ns;
+    long long arrive_b = sorted_worker->skiers[ *(const int *)b ].arrive_at_ns;
+    return ( arrive_a > arrive_b ) - ( arrive_a < arrive_b );
+}
+
+static void destroy_worker( skier_worker_t *worker ) {
+    free( worker->skiers );
+    free( worker->walking );
+    free( worker->waiting );
+    free( worker->in_bus );
+}
+
+static int init_worker( skier_worker_t *worker, ski_resort_t *resort,
+                        int first_skier_id, int skiers_amount,
+                        journal_t *journal ) {
+    worker->resort = resort;
+    worker->journal = journal;
+    worker->skiers_amount = skiers_amount;
+    worker->walking_next = 0;
+    worker->waiting_amount = 0;
+    worker->in_bus_amount = 0;
+    worker->at_resort = 0;
+
+    worker->skiers = malloc( sizeof( worker_skier_t ) * skiers_amount );
+    worker->walking = malloc( sizeof( int ) * skiers_amount );
+    worker->waiting = malloc( sizeof( skier_queue_t ) * resort->stops_amount );
+    worker->in_bus = malloc( sizeof( skier_queue_t ) * resort->buses_amount );
+    if ( worker->skiers == NULL || worker->walking == NULL ||
+         worker->waiting == NULL || worker->in_bus == NULL ) {
+        destroy_worker( worker );
+        return -1;
+    }
+
+    for ( int i = 0; i < resort->stops_amount; i++ ) {
+        worker->waiting[ i ].first = -1;
+        worker->waiting[ i ].last = -1;
+    }
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        worker->in_bus[ i ].first = -1;
+        worker->in_bus[ i ].last = -1;
+    }
+    for ( int i = 0; i < skiers_amount; i++ ) {
+        worker->skiers[ i ].skier_id = first_skier_id + i;
+        plan_skier( resort, first_skier_id + i,
+                    &worker->skiers[ i ].bus_stop_id,
+                    &worker->skiers[ i ].time_to_stop );
+        worker->skiers[ i ].ticket = NULL;
+        worker->skiers[ i ].next = -1;
+        worker->walking[ i ] = i;
+    }
+    return 0;
+}
+
+/// @brief Start every skier and put their walks into the timer queue.
+static void start_skiers( skier_worker_t *worker ) {
+    for ( int i = 0; i < worker->skiers_amount; i++ ) {
+        worker_skier_t *skier = &worker->skiers[ i ];
+
+        journal_skier( worker->journal, skier->skier_id, JOURNAL_STARTED );
+        skier->since = metrics_clock();
+        metrics_add_skier_start( &worker->resort->metrics, skier->since );
+        skier->arrive_at_ns =
+            monotonic_ns() + (long long)skier->time_to_stop * NS_PER_US;
+    }
+
+    sorted_worker = worker;
+    qsort( worker->walking, worker->skiers_amount, sizeof( int ),
+           compare_arrivals );
+    sorted_worker = NULL;
+}
+
+static bool arrive_walked_skiers( skier_worker_t *worker ) {
+    bool progressed = false;
+    long long now = monotonic_ns();
+
+    while ( worker->walking_next < worker->skiers_amount ) {
+        int skier_idx = worker->walking[ worker->walking_next ];
+        worker_skier_t *skier = &worker->skiers[ skier_idx ];
+        if ( skier->arrive_at_ns > now ) {
+            break;
+        }
+        worker->walking_next++;
+
+        skier->ticket = skier_arrive_at_stop( worker->resort,
+                                              skier->skier_id,
+                                              skier->bus_stop_id,
+                                              &skier->since, worker->journal );
+        queue_push( worker, &worker->waiting[ skier->bus_stop_id - 1 ],
+                    skier_idx );
+        worker->waiting_amount++;
+        progressed = true;
+    }
+    return progressed;
+}
+
+static void board_skier( skier_worker_t *worker, int stop_idx ) {
+    int skier_idx = queue_pop( worker, &worker->waiting[ stop_idx ] );
+    worker->waiting_amount--;
+
+    worker_skier_t *skier = &worker->skiers[ skier_idx ];
+    int bus_idx =
+        skier_board( worker->resort, skier->skier_id, stop_idx + 1,
+                     skier->ticket, &skier->since, worker->journal );
+    queue_push( worker, &worker->in_bus[ bus_idx ], skier_idx );
+    worker->in_bus_amount++;
+}
+
+static void unload_skier( skier_worker_t *worker, int bus_idx ) {
+    int skier_idx = queue_pop( worker, &worker->in_bus[ bus_idx ] );
+    worker->in_bus_amount--;
+
+    worker_skier_t *skier = &worker->skiers[ skier_idx ];
+    skier_get_out( worker->resort, bus_idx, skier->skier_id, &skier->since,
+                   worker->journal );
+    worker->at_resort++;
+}
+
+/// @brief Ticket of the skier of the worker waiting at the stop the longest.
+static stop_ticket_t *first_ticket( skier_worker_t *worker, int stop_idx ) {
+    return worker->skiers[ worker->waiting[ stop_idx ].first ].ticket;
+}
+
+static bool board_waiting_skiers( skier_worker_t *worker ) {
+    bool progressed = false;
+
+    for ( int i = 0; i < worker->resort->stops_amount; i++ ) {
+        if ( worker->waiting_amount == 0 ) {
+            break;
+        }
+        // Skiers of the worker arrived in the order of their tickets, the
+        // first one's is opened first
+        while ( !queue_is_empty( &worker->waiting[ i ] ) &&
+                futex_gate_is_open( &first_ticket( worker, i )->enter_bus ) ) {
+            board_skier( worker, i );
+            progressed = true;
+        }
+    }
+    return progressed;
+}
+
+static bool unload_skiers( skier_worker_t *worker ) {
+    bool progressed = false;
+
+    for ( int i = 0; i < worker->resort->buses_amount; i++ ) {
+        if ( worker->in_bus_amount == 0 ) {
+            break;
+        }
+        skibus_t *bus = &worker->resort->buses[ i ];
+        while ( !queue_is_empty( &worker->in_bus[ i ] ) &&
+                futex_handoff_try_take( &bus->get_out ) ) {
+            unload_skier( worker, i );
+            progressed = true;
+        }
+    }
+    return progressed;
+}
+
+/// @brief Nothing can progress right now. Block until the next walk ends or
+/// a permit the worker waits for is posted.
+static void idle( skier_worker_t *worker ) {
+    long long timeout_ns = IDLE_POLL_NS;
+    if ( worker->walking_next < worker->skiers_amount ) {
+        int skier_idx = worker->walking[ worker->walking_next ];
+        long long until_arrival =
+            worker->skiers[ skier_idx ].arrive_at_ns - monotonic_ns();
+        if ( until_arrival < timeout_ns ) {
+            timeout_ns = until_arrival;
+        }
+    }
+    if ( timeout_ns <= 0 ) {
+        return;
+    }
+
+    // Passengers are unloaded at once, they are the most urgent
+    for ( int i = 0; i < worker->resort->buses_amount; i++ ) {
+        if ( queue_is_empty( &worker->in_bus[ i ] ) ) {
+            continue;
+        }
+        skibus_t *bus = &worker->resort->buses[ i ];
+        if ( futex_handoff_take_timed( &bus->get_out, timeout_ns ) ) {
+            unload_skier( worker, i );
+        }
+        return;
+    }
+
+    for ( int i = 0; i < worker->resort->stops_amount; i++ ) {
+        if ( queue_is_empty( &worker->waiting[ i ] ) ) {
+            continue;
+        }
+        if ( futex_gate_wait_timed( &first_ticket( worker, i )->enter_bus,
+                                    timeout_ns ) ) {
+            board_skier( worker, i );
+        }
+        return;
+    }
+
+    // Only walking skiers are left
+    struct timespec sleep_time = { (time_t)( timeout_ns / NS_PER_S ),
+                                   (long)( timeout_ns % NS_PER_S ) };
+    while ( nanosleep( &sleep_time, &sleep_time ) == -1 && errno == EINTR ) {
+    }
+}
+
+int skier_worker_behavior( ski_resort_t *resort, int first_skier_id,
+                           int skiers_amount, journal_t *journal ) {
+    skier_worker_t worker;
+    if ( init_worker( &worker, resort, first_skier_id, skiers_amount,
+                      journal ) == -1 ) {
+        // Still arrive at the start, the others would wait for this worker
+        // forever
+        (void)wait_for_start( resort );
+        return -1;
+    }
+
+    if ( !wait_for_start( resort ) ) {
+        destroy_worker( &worker );
+        return 0;
+    }
+    start_skiers( &worker );
+
+    while ( worker.at_resort < worker.skiers_amount ) {
+        bool progressed = arrive_walked_skiers( &worker );
+        progressed = board_waiting_skiers( &worker ) || progressed;
+        progressed = unload_skiers( &worker ) || progressed;
+
+        if ( !progressed ) {
+            idle( &worker );
+        }
+    }
+
+    loginfo( "worker of skiers %i..%i is finishing", first_skier_id,
+             first_skier_id + skiers_amount - 1 );
+
+    destroy_worker( &worker );
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "../include/stop_bitmap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum { WORD_BITS = 64 };
+
+static int words_of( int bits ) {
+    return ( bits + WORD_BITS - 1 ) / WORD_BITS;
+}
+
+size_t stop_bitmap_words( int stops_amount ) {
+    size_t words = 0;
+    int bits = stops_amount;
+    do {
+        words += (size_t)words_of( bits );
+        bits = words_of( bits );
+    } while ( bits > 1 );
+    return words;
+}
+
+void init_stop_bitmap( stop_bitmap_t *bitmap, uint64_t *words,
+                       int stops_amount ) {
+    bitmap->stops_amount = stops_amount;
+    bitmap->words = words;
+    bitmap->levels = 0;
+
+    int offset = 0;
+    int bits = stops_amount;
+    do {
+        bitmap->level_offset[ bitmap->levels ] = offset;
+        bitmap->level_bits[ bitmap->levels ] = bits;
+        bitmap->levels++;
+        offset += words_of( bits );
+        bits = words_of( bits );
+    } while ( bits > 1 );
+}
+
+void stop_bitmap_add( stop_bitmap_t *bitmap, int stop_idx ) {
+    int idx = stop_idx;
+    for ( int level = 0; level < bitmap->levels; level++ ) {
+        bitmap->words[ bitmap->level_offset[ level ] + idx / WORD_BITS ] |=
+            1ULL << ( idx % WORD_BITS );
+        idx /= WORD_BITS;
+    }
+}
+
+void stop_bitmap_remove( stop_bitmap_t *bitmap, int stop_idx ) {
+    int idx = stop_idx;
+    for ( int level = 0; level < bitmap->levels; level++ ) {
+        uint64_t *word =
+            &bitmap->words[ bitmap->level_offset[ level ] + idx / WORD_BITS ];
+        uint64_t left = __atomic_and_fetch(
+            word, ~( 1ULL << ( idx % WORD_BITS ) ), __ATOMIC_RELAXED );
+        // The level above keeps the word marked while any bit is left
+        if ( left != 0 ) {
+            return;
+        }
+        idx /= WORD_BITS;
+    }
+}
+
+/// @brief First set bit of `level` from `idx` on.
+/// @return -1 if there is none.
+static int next_in_level( stop_bitmap_t *bitmap, int level, int idx ) {
+    uint64_t *words = bitmap->words + bitmap->level_offset[ level ];
+    while ( idx < bitmap->level_bits[ level ] ) {
+        int word_idx = idx / WORD_BITS;
+        uint64_t word =
+            __atomic_load_n( &words[ word_idx ], __ATOMIC_RELAXED ) &
+            ( ~0ULL << ( idx % WORD_BITS ) );
+        if ( word != 0 ) {
+            return word_idx * WORD_BITS + __builtin_ctzll( word );
+        }
+        if ( level + 1 == bitmap->levels ) {
+            return -1;
+        }
+        // Jump to the next nonzero word. It may have been zeroed since the
+        // level above was read, then look further.
+        int next_word = next_in_level( bitmap, level + 1, word_idx + 1 );
+        if ( next_word == -1 ) {
+            return -1;
+        }
+        idx = next_word * WORD_BITS;
+    }
+    return -1;
+}
+
+int stop_bitmap_next( stop_bitmap_t *bitmap, int stop_idx ) {
+    int next = next_in_level( bitmap, 0, stop_idx );
+    return next == -1 ? bitmap->stops_amount : next;
+}
@@ -0,0 +1,202 @@
+#include "../include/sync_stats.h"
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../include/sharing.h"
+
+// Bucket 0 counts waits that took no time, bucket k > 0 those that took
+// 2^(k-1)..2^k-1 ns. The last bucket takes everything longer.
+enum { SYNC_STATS_BUCKETS = 40 };
+
+// Width of the longest bar of a histogram
+enum { SYNC_STATS_BAR_WIDTH = 40 };
+
+struct sync_point_stats {
+    uint64_t waits;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[ SYNC_STATS_BUCKETS ];
+};
+typedef struct sync_point_stats sync_point_stats_t;
+
+static const char *sync_point_names[ SYNC_POINTS_AMOUNT ] = {
+    [SYNC_START] = "start",
+    [SYNC_JOURNAL_LOCK] = "journal lock",
+    [SYNC_JOURNAL_RING_FREE] = "journal ring_free",
+    [SYNC_JOURNAL_RING_PUBLISHED] = "journal ring_published",
+    [SYNC_ENTER_STOP_LOCK] = "enter_stop_lock",
+    [SYNC_ENTER_BUS] = "enter_bus",
+    [SYNC_BAY_LOCK] = "bay_lock",
+    [SYNC_BOARDING_DONE] = "boarding_done",
+    [SYNC_GET_OUT] = "get_out",
+    [SYNC_UNLOADING_DONE] = "unloading_done",
+    [SYNC_EVERYONE_AT_RESORT] = "everyone_at_resort",
+};
+
+// In the shared memory, so waits of every process add up
+static sync_point_stats_t *sync_stats = NULL;
+
+static uint64_t monotonic_ns( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int bucket_of( uint64_t ns ) {
+    if ( ns == 0 ) {
+        return 0;
+    }
+    int bucket = 64 - __builtin_clzll( ns );
+    return bucket < SYNC_STATS_BUCKETS ? bucket : SYNC_STATS_BUCKETS - 1;
+}
+
+size_t sync_stats_shared_size( void ) {
+    return shared_object_size( sizeof( sync_point_stats_t ) *
+                               SYNC_POINTS_AMOUNT );
+}
+
+int init_sync_stats( shared_arena_t *arena ) {
+    return init_shared_var( arena, (void **)&sync_stats,
+                            sizeof( sync_point_stats_t ) *
+                                SYNC_POINTS_AMOUNT );
+}
+
+uint64_t sync_stats_clock( void ) {
+    return monotonic_ns();
+}
+
+void sync_stats_add( sync_point_t point, uint64_t started_at ) {
+    uint64_t waited = monotonic_ns() - started_at;
+    if ( sync_stats == NULL ) {
+        return;
+    }
+    sync_point_stats_t *stats = &sync_stats[ point ];
+    __atomic_add_fetch( &stats->waits, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &stats->total_ns, waited, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &stats->buckets[ bucket_of( waited ) ], 1,
+                        __ATOMIC_RELAXED );
+
+    uint64_t max = __atomic_load_n( &stats->max_ns, __ATOMIC_RELAXED );
+    while ( waited > max &&
+            !__atomic_compare_exchange_n( &stats->max_ns, &max, waited, true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) ) {
+    }
+}
+
+int sync_stats_wait( sem_t *sem, sync_point_t point ) {
+    uint64_t started_at = monotonic_ns();
+    int result = sem_wait( sem );
+    sync_stats_add( point, started_at );
+    return result;
+}
+
+/// @brief Human readable upper bound of a bucket, "<512 ns", "<1.05 ms".
+static void format_bucket_bound( char *label, size_t size, int bucket ) {
+    if ( bucket == 0 ) {
+        (void)snprintf( label, size, "0 ns" );
+        return;
+    }
+    if ( bucket == SYNC_STATS_BUCKETS - 1 ) {
+        (void)snprintf( label, size, ">=%.3g s",
+                        (double)( 1ULL << ( bucket - 1 ) ) / 1e9 );
+        return;
+    }
+
+    double bound = (double)( 1ULL << bucket );
+    if ( bound < 1e3 ) {
+        (void)snprintf( label, size, "<%.0f ns", bound );
+    } else if ( bound < 1e6 ) {
+        (void)snprintf( label, size, "<%.3g us", bound / 1e3 );
+    } else if ( bound < 1e9 ) {
+        (void)snprintf( label, size, "<%.3g ms", bound / 1e6 );
+    } else {
+        (void)snprintf( label, size, "<%.3g s", bound / 1e9 );
+    }
+}
+
+static void print_histogram( FILE *out, sync_point_stats_t *stats ) {
+    int first = 0;
+    int last = SYNC_STATS_BUCKETS - 1;
+    uint64_t most = 0;
+    while ( stats->buckets[ first ] == 0 ) {
+        first++;
+    }
+    while ( stats->buckets[ last ] == 0 ) {
+        last--;
+    }
+    for ( int i = first; i <= last; i++ ) {
+        if ( stats->buckets[ i ] > most ) {
+            most = stats->buckets[ i ];
+        }
+    }
+
+    for ( int i = first; i <= last; i++ ) {
+        char label[ 32 ];
+        format_bucket_bound( label, sizeof( label ), i );
+        int bar = (int)( stats->buckets[ i ] * SYNC_STATS_BAR_WIDTH / most );
+        if ( bar == 0 && stats->buckets[ i ] > 0 ) {
+            bar = 1;
+        }
+        (void)fprintf( out, "  %10s %10llu %6.2f%% %.*s\n", label,
+                       (unsigned long long)stats->buckets[ i ],
+                       100.0 * (double)stats->buckets[ i ] /
+                           (double)stats->waits,
+                       bar, "########################################" );
+    }
+}
+
+void print_sync_stats( FILE *out ) {
+    if ( sync_stats == NULL ) {
+        return;
+    }
+
+    (void)fprintf( out, "%-24s %10s %12s %10s %12s\n", "sync point", "waits",
+                   "total ms", "mean us", "max us" );
+    for ( int i = 0; i < SYNC_POINTS_AMOUNT; i++ ) {
+        sync_point_stats_t *stats = &sync_stats[ i ];
+        if ( stats->waits == 0 ) {
+            continue;
+        }
+        (void)fprintf( out, "%-24s %10llu %12.3f %10.3f %12.3f\n",
+                       sync_point_names[ i ],
+                       (unsigned long long)stats->waits,
+                       (double)stats->total_ns / 1e6,
+                       (double)stats->total_ns / (double)stats->waits / 1e3,
+                       (double)stats->max_ns / 1e3 );
+    }
+
+    for ( int i = 0; i < SYNC_POINTS_AMOUNT; i++ ) {
+        if ( sync_stats[ i ].waits == 0 ) {
+            continue;
+        }
+        (void)fprintf( out, "\n%s\n", sync_point_names[ i ] );
+        print_histogram( out, &sync_stats[ i ] );
+    }
+}
+
+void print_sync_stats_totals( FILE *out ) {
+    if ( sync_stats == NULL ) {
+        return;
+    }
+
+    for ( int i = 0; i < SYNC_POINTS_AMOUNT; i++ ) {
+        // A single word per point, "journal lock" is "journal_lock"
+        char name[ 32 ];
+        (void)snprintf( name, sizeof( name ), "%s", sync_point_names[ i ] );
+        for ( char *c = name; *c != '\0'; c++ ) {
+            if ( *c == ' ' ) {
+                *c = '_';
+            }
+        }
+        (void)fprintf(
+            out, "lock_wait %s %llu %llu\n", name,
+            (unsigned long long)__atomic_load_n( &sync_stats[ i ].waits,
+                                                 __ATOMIC_RELAXED ),
+            (unsigned long long)__atomic_load_n( &sync_stats[ i ].total_ns,
+                                                 __ATOMIC_RELAXED ) );
+    }
+}
@@ -0,0 +1,799 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_INPUT_FILENAME "proj2.out"
+
+static const char HELP_TEXT[] =
+    "Usage: ./proj2-validate [OPTIONS] [FILE]\n"
+    "\n"
+    "Check a text journal written by ./proj2. Reads " DEFAULT_INPUT_FILENAME
+    " if FILE is not given\n"
+    "and the standard input if it is -. Prints nothing if the journal is\n"
+    "valid.\n"
+    "\n"
+    "Besides the shape of every line it checks that:\n"
+    "- entries are numbered 1, 2, 3, ...\n"
+    "- skibuses drive the stops in order and every one of them finishes\n"
+    "- skiers start, arrive, board and go to ski in this order\n"
+    "- skiers board only while a skibus is at their stop and get out only\n"
+    "  while it is at the final stop\n"
+    "- every skier that started goes to ski before a skibus finishes\n"
+    "\n"
+    "Options:\n"
+    "- --skiers=L: exactly skiers 1..L take part\n"
+    "- --stops=Z: the route has Z stops\n"
+    "- --capacity=K: no skibus carries more than K skiers, and none leaves\n"
+    "  a stop with free seats while skiers that arrived before it wait.\n"
+    "  While several skibuses are at a stop, it is only known that their\n"
+    "  free seats were enough for everyone boarding there.\n"
+    "- --skip-empty-stops: the journal is of ./proj2 --skip-empty-stops,\n"
+    "  skibuses drive the stops in order but may leave any of them out\n"
+    "- --max-errors=N: errors printed before the rest is only counted\n"
+    "  (default 20)\n";
+
+enum { LINE_MAX_SIZE = 256, INPUT_BUFFER_SIZE = 1024 * 1024 };
+
+enum { DEFAULT_MAX_ERRORS = 20 };
+
+// Where a skibus is
+enum { BUS_ON_ROAD = 0, BUS_AT_FINAL = -1 };
+
+// Id of the skibus of an unlabelled journal, "BUS:"
+enum { UNLABELLED_BUS_ID = 0 };
+
+enum skier_state {
+    SKIER_UNSEEN,
+    SKIER_STARTED,
+    SKIER_WAITING,
+    SKIER_ABOARD,
+    SKIER_SKIING
+};
+
+struct skier {
+    unsigned char state;
+    int stop_id;
+    int bus_id;
+    // Line of the "arrived to" entry
+    long long arrived_at;
+    // Neighbours in the queue of skiers waiting at the same stop, 0 if none
+    int prev_waiting;
+    int next_waiting;
+};
+typedef struct skier skier_t;
+
+struct bus {
+    bool started;
+    bool finished;
+    // Stop id, BUS_ON_ROAD or BUS_AT_FINAL
+    int at;
+    int next_stop_id;
+    // Line of the last "arrived to" entry
+    long long arrived_at;
+    // Another skibus was at the same stop during this stay
+    bool shared_stop;
+    int passengers;
+    // Passengers include skiers that boarded at a shared stop, so they are
+    // only an estimate until the skibus leaves final
+    bool uncertain;
+};
+typedef struct bus bus_t;
+
+struct stop {
+    // Skiers waiting at the stop, in the order of their arrival
+    int first_waiting;
+    int last_waiting;
+    // Skiers that boarded while several skibuses were at the stop. They are
+    // counted to the skibuses as these leave.
+    int pending_boardings;
+};
+typedef struct stop stop_t;
+
+struct validator {
+    // Checks enabled by options, 0 if disabled
+    int skiers_amount;
+    int stops_amount;
+    int capacity;
+    long long max_errors;
+
+    long long line_number;
+    // Number the next entry should have
+    long long next_number;
+    long long errors;
+
+    // Indexed by the skier id
+    skier_t *skiers;
+    int skiers_size;
+    int skiers_started;
+    int skiers_skiing;
+
+    // Indexed by the skibus id, 0 is the unlabelled one
+    bus_t *buses;
+    int buses_size;
+    bool labelled_buses;
+    bool unlabelled_buses;
+    bool any_bus_finished;
+    // Stops of the route, learned from the first lap if not given
+    int route_length;
+    // Skibuses may drive past stops
+    bool skip_empty_stops;
+
+    // Indexed by the stop id
+    stop_t *stops;
+    int stops_size;
+};
+typedef struct validator validator_t;
+
+static void report( validator_t *validator, const char *format, ... ) {
+    validator->errors++;
+    if ( validator->errors > validator->max_errors ) {
+        return;
+    }
+
+    va_list args;
+    va_start( args, format );
+    if ( validator->line_number > 0 ) {
+        (void)printf( "line %lld: ", validator->line_number );
+    }
+    (void)vprintf( format, args );
+    (void)printf( "\n" );
+    va_end( args );
+}
+
+/// @brief Grow an array indexed by ids so `id` fits, new items are zeroed.
+static void *grow( void *array, int *size, int id, size_t item_size ) {
+    if ( id < *size ) {
+        return array;
+    }
+
+    int new_size = *size > 0 ? *size : 64;
+    while ( new_size <= id ) {
+        new_size *= 2;
+    }
+    char *grown = realloc( array, (size_t)new_size * item_size );
+    if ( grown == NULL ) {
+        (void)fprintf( stderr, "failed to allocate memory\n" );
+        exit( EXIT_FAILURE );
+    }
+    memset( grown + (size_t)*size * item_size, 0,
+            (size_t)( new_size - *size ) * item_size );
+    *size = new_size;
+    return grown;
+}
+
+static skier_t *get_skier( validator_t *validator, int skier_id ) {
+    validator->skiers = grow( validator->skiers, &validator->skiers_size,
+                              skier_id, sizeof( skier_t ) );
+    return &validator->skiers[ skier_id ];
+}
+
+static bus_t *get_bus( validator_t *validator, int bus_id ) {
+    int old_size = validator->buses_size;
+    validator->buses = grow( validator->buses, &validator->buses_size, bus_id,
+                             sizeof( bus_t ) );
+    for ( int i = old_size; i < validator->buses_size; i++ ) {
+        validator->buses[ i ].next_stop_id = 1;
+    }
+    return &validator->buses[ bus_id ];
+}
+
+static stop_t *get_stop( validator_t *validator, int stop_id ) {
+    validator->stops = grow( validator->stops, &validator->stops_size, stop_id,
+                             sizeof( stop_t ) );
+    return &validator->stops[ stop_id ];
+}
+
+static void enqueue_waiting( validator_t *validator, int skier_id ) {
+    skier_t *skier = &validator->skiers[ skier_id ];
+    stop_t *stop = get_stop( validator, skier->stop_id );
+
+    skier->prev_waiting = stop->last_waiting;
+    skier->next_waiting = 0;
+    if ( stop->last_waiting == 0 ) {
+        stop->first_waiting = skier_id;
+    } else {
+        validator->skiers[ stop->last_waiting ].next_waiting = skier_id;
+    }
+    stop->last_waiting = skier_id;
+}
+
+static void dequeue_waiting( validator_t *validator, int skier_id ) {
+    skier_t *skier = &validator->skiers[ skier_id ];
+    stop_t *stop = &validator->stops[ skier->stop_id ];
+
+    if ( skier->prev_waiting == 0 ) {
+        stop->first_waiting = skier->next_waiting;
+    } else {
+        validator->skiers[ skier->prev_waiting ].next_waiting =
+            skier->next_waiting;
+    }
+    if ( skier->next_waiting == 0 ) {
+        stop->last_waiting = skier->prev_waiting;
+    } else {
+        validator->skiers[ skier->next_waiting ].prev_waiting =
+            skier->prev_waiting;
+    }
+}
+
+/// @brief Parse a number without a sign or leading zeros, "[1-9][0-9]*".
+static bool parse_id( const char **cursor, int *id ) {
+    const char *c = *cursor;
+    if ( *c < '1' || *c > '9' ) {
+        return false;
+    }
+    long long value = 0;
+    while ( *c >= '0' && *c <= '9' ) {
+        value = value * 10 + ( *c - '0' );
+        if ( value > 0x7fffffff ) {
+            return false;
+        }
+        c++;
+    }
+    *id = (int)value;
+    *cursor = c;
+    return true;
+}
+
+static bool skip( const char **cursor, const char *text ) {
+    size_t length = strlen( text );
+    if ( strncmp( *cursor, text, length ) != 0 ) {
+        return false;
+    }
+    *cursor += length;
+    return true;
+}
+
+static void check_skiers_may_act( validator_t *validator ) {
+    if ( validator->any_bus_finished ) {
+        report( validator, "skier entry after a skibus finished" );
+    }
+}
+
+static void skier_started( validator_t *validator, int skier_id ) {
+    skier_t *skier = get_skier( validator, skier_id );
+    check_skiers_may_act( validator );
+    if ( skier->state != SKIER_UNSEEN ) {
+        report( validator, "L %i started again", skier_id );
+        return;
+    }
+    skier->state = SKIER_STARTED;
+    validator->skiers_started++;
+}
+
+static void skier_arrived( validator_t *validator, int skier_id,
+                           int stop_id ) {
+    skier_t *skier = get_skier( validator, skier_id );
+    check_skiers_may_act( validator );
+    if ( skier->state != SKIER_STARTED ) {
+        report( validator, "L %i arrived to a stop twice or before starting",
+                skier_id );
+        return;
+    }
+    skier->state = SKIER_WAITING;
+    skier->stop_id = stop_id;
+    skier->arrived_at = validator->line_number;
+    enqueue_waiting( validator, skier_id );
+}
+
+static void skier_boarding( validator_t *validator, int skier_id ) {
+    skier_t *skier = get_skier( validator, skier_id );
+    check_skiers_may_act( validator );
+    if ( skier->state != SKIER_WAITING ) {
+        report( validator, "L %i boarded without waiting at a stop",
+                skier_id );
+        return;
+    }
+
+    int bus_id = -1;
+    int buses_at_stop = 0;
+    int free_seats = 0;
+    // Seats are only checked if passengers of every skibus are known
+    bool check_seats = validator->capacity > 0;
+    for ( int i = 0; i < validator->buses_size; i++ ) {
+        bus_t *bus = &validator->buses[ i ];
+        if ( bus->at == skier->stop_id ) {
+            bus_id = i;
+            buses_at_stop++;
+            free_seats += validator->capacity - bus->passengers;
+            check_seats = check_seats && !bus->uncertain;
+        }
+    }
+    if ( buses_at_stop == 0 ) {
+        report( validator, "L %i boarded while no skibus was at stop %i",
+                skier_id, skier->stop_id );
+        return;
+    }
+
+    stop_t *stop = get_stop( validator, skier->stop_id );
+    dequeue_waiting( validator, skier_id );
+    skier->state = SKIER_ABOARD;
+
+    if ( buses_at_stop > 1 || stop->pending_boardings > 0 ) {
+        skier->bus_id = -1;
+        stop->pending_boardings++;
+        if ( check_seats && stop->pending_boardings > free_seats ) {
+            report( validator,
+                    "L %i boarded at stop %i while its skibuses were full",
+                    skier_id, skier->stop_id );
+        }
+        return;
+    }
+
+    bus_t *bus = &validator->buses[ bus_id ];
+    if ( check_seats && bus->passengers >= validator->capacity ) {
+        report( validator, "L %i boarded a full skibus at stop %i", skier_id,
+                skier->stop_id );
+    }
+    skier->bus_id = bus_id;
+    bus->passengers++;
+}
+
+static void skier_going_to_ski( validator_t *validator, int skier_id ) {
+    skier_t *skier = get_skier( validator, skier_id );
+    check_skiers_may_act( validator );
+    if ( skier->state != SKIER_ABOARD ) {
+        report( validator, "L %i went to ski without riding a skibus",
+                skier_id );
+        return;
+    }
+
+    int bus_id = skier->bus_id;
+    if ( bus_id == -1 || validator->buses[ bus_id ].at != BUS_AT_FINAL ) {
+        // Boarded at a shared stop, so it rode one of those at final
+        bus_id = -1;
+        for ( int i = 0; i < validator->buses_size; i++ ) {
+            bus_t *bus = &validator->buses[ i ];
+            if ( bus->at == BUS_AT_FINAL &&
+                 ( bus_id == -1 || bus->passengers > 0 ) ) {
+                bus_id = i;
+            }
+        }
+    }
+    if ( bus_id == -1 ) {
+        report( validator, "L %i got out while no skibus was at final",
+                skier_id );
+    } else if ( validator->buses[ bus_id ].passengers > 0 ) {
+        validator->buses[ bus_id ].passengers--;
+    }
+
+    skier->state = SKIER_SKIING;
+    validator->skiers_skiing++;
+}
+
+static void share_stop( validator_t *validator, bus_t *arriving ) {
+    for ( int i = 0; i < validator->buses_size; i++ ) {
+        bus_t *bus = &validator->buses[ i ];
+        if ( bus != arriving && bus->at == arriving->at ) {
+            bus->shared_stop = true;
+            arriving->shared_stop = true;
+        }
+    }
+}
+
+static void bus_started( validator_t *validator, int bus_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( bus->started && bus_id == UNLABELLED_BUS_ID ) {
+        report( validator, "several unlabelled skibuses, run ./proj2 with "
+                           "--label-buses to validate them" );
+        return;
+    }
+    if ( bus->started ) {
+        report( validator, "skibus started again" );
+        return;
+    }
+    bus->started = true;
+}
+
+static bool check_bus_running( validator_t *validator, bus_t *bus ) {
+    if ( !bus->started || bus->finished ) {
+        report( validator, "skibus drives without running" );
+        return false;
+    }
+    return true;
+}
+
+static void bus_arrived( validator_t *validator, int bus_id, int stop_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( !check_bus_running( validator, bus ) ) {
+        return;
+    }
+    if ( bus->at != BUS_ON_ROAD ) {
+        report( validator, "skibus arrived to %i without leaving first",
+                stop_id );
+    }
+    if ( validator->skip_empty_stops && stop_id < bus->next_stop_id ) {
+        report( validator, "skibus arrived to %i after %i", stop_id,
+                bus->next_stop_id - 1 );
+    } else if ( !validator->skip_empty_stops &&
+                stop_id != bus->next_stop_id ) {
+        report( validator, "skibus arrived to %i instead of %i", stop_id,
+                bus->next_stop_id );
+    }
+    if ( validator->route_length > 0 && stop_id > validator->route_length ) {
+        report( validator, "skibus arrived to %i of a route of %i stops",
+                stop_id, validator->route_length );
+    }
+
+    bus->at = stop_id;
+    bus->arrived_at = validator->line_number;
+    bus->shared_stop = false;
+    share_stop( validator, bus );
+}
+
+/// @brief A skibus leaves a stop where skiers boarded while several skibuses
+/// were there. It takes as many of them as fit, the skibuses left at the stop
+/// take the rest.
+static void count_pending_boardings( validator_t *validator, bus_t *leaving,
+                                     stop_t *stop ) {
+    int taken = stop->pending_boardings;
+    if ( validator->capacity > 0 &&
+         taken > validator->capacity - leaving->passengers ) {
+        taken = validator->capacity - leaving->passengers;
+    }
+    if ( taken < 0 ) {
+        taken = 0;
+    }
+    bool leaving_was_uncertain = leaving->uncertain;
+    leaving->passengers += taken;
+    leaving->uncertain = true;
+    stop->pending_boardings -= taken;
+
+    bus_t *staying = NULL;
+    int buses_staying = 0;
+    for ( int i = 0; i < validator->buses_size; i++ ) {
+        bus_t *bus = &validator->buses[ i ];
+        if ( bus != leaving && bus->at == leaving->at ) {
+            staying = bus;
+            buses_staying++;
+        }
+    }
+    if ( buses_staying == 0 && stop->pending_boardings > 0 ) {
+        // An estimate may have counted too many to an earlier skibus
+        if ( !leaving_was_uncertain ) {
+            report( validator,
+                    "%i skiers boarded at stop %i beyond free seats",
+                    stop->pending_boardings, leaving->at );
+        }
+        leaving->passengers += stop->pending_boardings;
+        stop->pending_boardings = 0;
+    } else if ( buses_staying == 1 ) {
+        // Only one skibus can have them
+        staying->passengers += stop->pending_boardings;
+        staying->uncertain = true;
+        stop->pending_boardings = 0;
+    }
+}
+
+static void bus_leaving( validator_t *validator, int bus_id, int stop_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( !check_bus_running( validator, bus ) ) {
+        return;
+    }
+    if ( bus->at != stop_id ) {
+        report( validator, "skibus left %i without arriving to it", stop_id );
+        return;
+    }
+
+    stop_t *stop = get_stop( validator, stop_id );
+    if ( stop->pending_boardings > 0 ) {
+        count_pending_boardings( validator, bus, stop );
+    }
+
+    // Everyone waiting before the skibus arrived fits in or it is full
+    int first_waiting = stop->first_waiting;
+    if ( validator->capacity > 0 && !bus->shared_stop && !bus->uncertain &&
+         first_waiting != 0 &&
+         validator->skiers[ first_waiting ].arrived_at < bus->arrived_at &&
+         bus->passengers < validator->capacity ) {
+        report( validator,
+                "skibus left %i with free seats while L %i waited there",
+                stop_id, first_waiting );
+    }
+
+    // Who of the skibuses took the skiers of a shared stop is not known
+    if ( bus->shared_stop ) {
+        bus->uncertain = true;
+    }
+    bus->at = BUS_ON_ROAD;
+    bus->next_stop_id = stop_id + 1;
+}
+
+static void bus_arrived_to_final( validator_t *validator, int bus_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( !check_bus_running( validator, bus ) ) {
+        return;
+    }
+    if ( bus->at != BUS_ON_ROAD ) {
+        report( validator, "skibus arrived to final without leaving first" );
+    }
+
+    // Which stops were left out at the end of the route is not known
+    int driven = bus->next_stop_id - 1;
+    if ( !validator->skip_empty_stops ) {
+        if ( validator->route_length == 0 ) {
+            validator->route_length = driven;
+        }
+        if ( driven != validator->route_length ) {
+            report( validator, "skibus arrived to final after %i of %i stops",
+                    driven, validator->route_length );
+        }
+    }
+
+    bus->at = BUS_AT_FINAL;
+    bus->arrived_at = validator->line_number;
+}
+
+static void bus_leaving_final( validator_t *validator, int bus_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( !check_bus_running( validator, bus ) ) {
+        return;
+    }
+    if ( bus->at != BUS_AT_FINAL ) {
+        report( validator, "skibus left final without arriving to it" );
+        return;
+    }
+    if ( bus->passengers > 0 && !bus->uncertain ) {
+        report( validator, "skibus left final with %i passengers",
+                bus->passengers );
+    }
+    bus->passengers = 0;
+    bus->uncertain = false;
+
+    bus->at = BUS_ON_ROAD;
+    bus->next_stop_id = 1;
+}
+
+static void bus_finish( validator_t *validator, int bus_id ) {
+    bus_t *bus = get_bus( validator, bus_id );
+    if ( !check_bus_running( validator, bus ) ) {
+        return;
+    }
+    if ( bus->at != BUS_ON_ROAD || bus->next_stop_id != 1 ) {
+        report( validator, "skibus finished in the middle of its route" );
+    }
+    if ( validator->skiers_skiing < validator->skiers_started ) {
+        report( validator, "skibus finished while %i skiers did not ski",
+                validator->skiers_started - validator->skiers_skiing );
+    }
+
+    bus->finished = true;
+    validator->any_bus_finished = true;
+}
+
+/// @brief Parse "L <id>: <event>" and apply it.
+static bool validate_skier( validator_t *validator, const char *cursor ) {
+    int skier_id = 0;
+    int stop_id = 0;
+    if ( !parse_id( &cursor, &skier_id ) || !skip( &cursor, ": " ) ) {
+        return false;
+    }
+    if ( validator->skiers_amount > 0 &&
+         skier_id > validator->skiers_amount ) {
+        report( validator, "L %i out of %i skiers", skier_id,
+                validator->skiers_amount );
+    }
+
+    if ( strcmp( cursor, "started" ) == 0 ) {
+        skier_started( validator, skier_id );
+    } else if ( strcmp( cursor, "boarding" ) == 0 ) {
+        skier_boarding( validator, skier_id );
+    } else if ( strcmp( cursor, "going to ski" ) == 0 ) {
+        skier_going_to_ski( validator, skier_id );
+    } else if ( skip( &cursor, "arrived to " ) &&
+                parse_id( &cursor, &stop_id ) && *cursor == '\0' ) {
+        if ( validator->stops_amount > 0 &&
+             stop_id > validator->stops_amount ) {
+            report( validator, "L %i arrived to %i of %i stops", skier_id,
+                    stop_id, validator->stops_amount );
+        }
+        skier_arrived( validator, skier_id, stop_id );
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Parse "BUS: <event>" or "BUS <id>: <event>" and apply it.
+static bool validate_bus( validator_t *validator, const char *cursor ) {
+    int bus_id = UNLABELLED_BUS_ID;
+    int stop_id = 0;
+    if ( skip( &cursor, ": " ) ) {
+        validator->unlabelled_buses = true;
+    } else if ( skip( &cursor, " " ) && parse_id( &cursor, &bus_id ) &&
+                skip( &cursor, ": " ) ) {
+        validator->labelled_buses = true;
+    } else {
+        return false;
+    }
+    if ( validator->labelled_buses && validator->unlabelled_buses ) {
+        report( validator, "labelled and unlabelled skibuses are mixed" );
+        validator->unlabelled_buses = false;
+    }
+
+    if ( strcmp( cursor, "started" ) == 0 ) {
+        bus_started( validator, bus_id );
+    } else if ( strcmp( cursor, "arrived to final" ) == 0 ) {
+        bus_arrived_to_final( validator, bus_id );
+    } else if ( strcmp( cursor, "leaving final" ) == 0 ) {
+        bus_leaving_final( validator, bus_id );
+    } else if ( strcmp( cursor, "finish" ) == 0 ) {
+        bus_finish( validator, bus_id );
+    } else if ( skip( &cursor, "arrived to " ) &&
+                parse_id( &cursor, &stop_id ) && *cursor == '\0' ) {
+        bus_arrived( validator, bus_id, stop_id );
+    } else if ( skip( &cursor, "leaving " ) &&
+                parse_id( &cursor, &stop_id ) && *cursor == '\0' ) {
+        bus_leaving( validator, bus_id, stop_id );
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void validate_line( validator_t *validator, const char *line ) {
+    const char *cursor = line;
+    int number = 0;
+    if ( !parse_id( &cursor, &number ) || !skip( &cursor, ": " ) ) {
+        report( validator, "line format error: %s", line );
+        return;
+    }
+    if ( number != validator->next_number ) {
+        report( validator, "entry number %i, expected %lld", number,
+                validator->next_number );
+    }
+    // Continue from it, so a gap is reported only once
+    validator->next_number = (long long)number + 1;
+
+    bool valid = false;
+    if ( skip( &cursor, "L " ) ) {
+        valid = validate_skier( validator, cursor );
+    } else if ( skip( &cursor, "BUS" ) ) {
+        valid = validate_bus( validator, cursor );
+    }
+    if ( !valid ) {
+        report( validator, "line format error: %s", line );
+    }
+}
+
+static void validate_end( validator_t *validator ) {
+    validator->line_number = 0;
+
+    if ( validator->skiers_started == 0 ) {
+        report( validator, "no skier started" );
+    }
+    if ( validator->skiers_amount > 0 &&
+         validator->skiers_started != validator->skiers_amount ) {
+        report( validator, "%i of %i skiers started",
+                validator->skiers_started, validator->skiers_amount );
+    }
+    if ( validator->skiers_skiing != validator->skiers_started ) {
+        report( validator, "%i of %i skiers that started went to ski",
+                validator->skiers_skiing, validator->skiers_started );
+    }
+
+    int buses_started = 0;
+    for ( int i = 0; i < validator->buses_size; i++ ) {
+        bus_t *bus = &validator->buses[ i ];
+        if ( bus->started ) {
+            buses_started++;
+        }
+        if ( bus->started && !bus->finished && i == UNLABELLED_BUS_ID ) {
+            report( validator, "BUS did not finish" );
+        } else if ( bus->started && !bus->finished ) {
+            report( validator, "BUS %i did not finish", i );
+        }
+    }
+    if ( buses_started == 0 ) {
+        report( validator, "no skibus started" );
+    }
+}
+
+static int arg_to_positive_or_exit( const char *option, const char *arg ) {
+    char *end = NULL;
+    long value = strtol( arg, &end, 10 );
+    if ( *arg == '\0' || *end != '\0' || value < 1 || value > 0x7fffffff ) {
+        (void)fprintf( stderr, "%s must be a positive number\n", option );
+        exit( EXIT_FAILURE );
+    }
+    return (int)value;
+}
+
+int main( int argc, char *argv[] ) {
+    validator_t validator;
+    memset( &validator, 0, sizeof( validator ) );
+    validator.max_errors = DEFAULT_MAX_ERRORS;
+    validator.next_number = 1;
+
+    char *input_name = DEFAULT_INPUT_FILENAME;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( strcmp( argv[ i ], "--help" ) == 0 ||
+             strcmp( argv[ i ], "-h" ) == 0 ) {
+            (void)printf( HELP_TEXT );
+            return EXIT_SUCCESS;
+        }
+        if ( strncmp( argv[ i ], "--skiers=", strlen( "--skiers=" ) ) == 0 ) {
+            validator.skiers_amount = arg_to_positive_or_exit(
+                "--skiers", argv[ i ] + strlen( "--skiers=" ) );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--stops=", strlen( "--stops=" ) ) == 0 ) {
+            validator.stops_amount = arg_to_positive_or_exit(
+                "--stops", argv[ i ] + strlen( "--stops=" ) );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--capacity=", strlen( "--capacity=" ) ) ==
+             0 ) {
+            validator.capacity = arg_to_positive_or_exit(
+                "--capacity", argv[ i ] + strlen( "--capacity=" ) );
+            continue;
+        }
+        if ( strcmp( argv[ i ], "--skip-empty-stops" ) == 0 ) {
+            validator.skip_empty_stops = true;
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--max-errors=",
+                      strlen( "--max-errors=" ) ) == 0 ) {
+            validator.max_errors = arg_to_positive_or_exit(
+                "--max-errors", argv[ i ] + strlen( "--max-errors=" ) );
+            continue;
+        }
+        if ( strncmp( argv[ i ], "--", 2 ) == 0 ) {
+            (void)fprintf( stderr, "unknown option %s\n", argv[ i ] );
+            return EXIT_FAILURE;
+        }
+        input_name = argv[ i ];
+    }
+    validator.route_length = validator.stops_amount;
+
+    FILE *input = stdin;
+    if ( strcmp( input_name, "-" ) != 0 ) {
+        input = fopen( input_name, "re" );
+        if ( input == NULL ) {
+            (void)fprintf( stderr, "failed to open %s\n", input_name );
+            return EXIT_FAILURE;
+        }
+    }
+    (void)setvbuf( input, NULL, _IOFBF, INPUT_BUFFER_SIZE );
+
+    char line[ LINE_MAX_SIZE ];
+    while ( fgets( line, sizeof( line ), input ) != NULL ) {
+        validator.line_number++;
+
+        size_t length = strlen( line );
+        if ( length > 0 && line[ length - 1 ] == '\n' ) {
+            line[ length - 1 ] = '\0';
+        } else if ( !feof( input ) ) {
+            report( &validator, "line is too long" );
+            int c;
+            while ( ( c = getc( input ) ) != EOF && c != '\n' ) {
+            }
+            continue;
+        }
+        validate_line( &validator, line );
+    }
+
+    int result = EXIT_SUCCESS;
+    if ( ferror( input ) ) {
+        (void)fprintf( stderr, "failed to read %s\n", input_name );
+        result = EXIT_FAILURE;
+    }
+    if ( input != stdin ) {
+        (void)fclose( input );
+    }
+
+    validate_end( &validator );
+    if ( validator.errors > validator.max_errors ) {
+        (void)printf( "%lld more errors\n",
+                      validator.errors - validator.max_errors );
+    }
+    if ( validator.errors > 0 ) {
+        result = EXIT_FAILURE;
+    }
+
+    free( validator.skiers );
+    free( validator.buses );
+    free( validator.stops );
+    return result;
+}
@@ -0,0 +1,499 @@
+#include "../include/virtual_time.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/dbg.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/random.h"
+#include "../include/route.h"
+#include "../include/sharing.h"
+#include "../include/simulation.h"
+#include "../include/ski_resort.h"
+#include "../include/stop_bitmap.h"
+
+#define VIRTUAL_TIME_ARENA_NAME "/ski_resort_virtual_time"
+
+enum { NS_PER_US = 1000 };
+
+/// @brief Something that happens at a point in virtual time. Either a skier
+/// arrives to their stop or a skibus arrives to its next stop.
+struct virtual_event {
+    uint64_t time_ns;
+    // Events at the same time happen in the order they were scheduled
+    uint64_t sequence;
+    // Skier id if positive, minus the skibus index otherwise
+    int actor_id;
+};
+typedef struct virtual_event virtual_event_t;
+
+/// @brief Binary min-heap of events.
+struct event_queue {
+    virtual_event_t *events;
+    size_t size;
+    uint64_t next_sequence;
+};
+typedef struct event_queue event_queue_t;
+
+struct virtual_bus {
+    int journal_id;
+    rand_stream_t random;
+    int *passengers;
+    int passengers_amount;
+    // Index of the stop the bus arrives to next
+    int stop_idx;
+    // First segment of the ride to it
+    int segment_idx;
+    // Nothing was left to pick up, waits for the others to finish
+    bool parked;
+    bool finished;
+};
+typedef struct virtual_bus virtual_bus_t;
+
+struct virtual_resort {
+    journal_t *journal;
+    event_queue_t queue;
+    // Time of the event being processed
+    uint64_t now_ns;
+    // Time of the last "finish" entry
+    uint64_t finished_at_ns;
+
+    int skiers_amount;
+    int skiers_at_resort;
+    int max_walk_to_stop_time;
+    int stops_amount;
+    route_t *route;
+
+    // Stop every skier walks to, indexed by skier id
+    int *skier_stops;
+    // Skiers waiting at a stop are linked in arrival order, indexed by
+    // skier id, 0 ends the queue
+    int *next_waiting;
+    int *first_waiting;
+    int *last_waiting;
+    // Skiers still walking to a stop, indexed by stop id
+    int *skiers_en_route;
+    // Stops someone waits at or walks to
+    stop_bitmap_t stops_with_demand;
+    bool skip_empty_stops;
+    // When the last step of a skier was done, indexed by skier id
+    uint64_t *since_ns;
+
+    int bus_capacity;
+    virtual_bus_t *buses;
+    int buses_amount;
+    // Seats of all the skibuses
+    int *passengers;
+
+    resort_metrics_t *metrics;
+};
+typedef struct virtual_resort virtual_resort_t;
+
+static bool event_before( virtual_event_t *a, virtual_event_t *b ) {
+    if ( a->time_ns != b->time_ns ) {
+        return a->time_ns < b->time_ns;
+    }
+    return a->sequence < b->sequence;
+}
+
+static void swap_events( virtual_event_t *a, virtual_event_t *b ) {
+    virtual_event_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void sift_down( event_queue_t *queue, size_t idx ) {
+    while ( true ) {
+        size_t smallest = idx;
+        size_t left = 2 * idx + 1;
+        size_t right = left + 1;
+        if ( left < queue->size &&
+             event_before( &queue->events[ left ],
+                           &queue->events[ smallest ] ) ) {
+            smallest = left;
+        }
+        if ( right < queue->size &&
+             event_before( &queue->events[ right ],
+                           &queue->events[ smallest ] ) ) {
+            smallest = right;
+        }
+        if ( smallest == idx ) {
+            return;
+        }
+        swap_events( &queue->events[ idx ], &queue->events[ smallest ] );
+        idx = smallest;
+    }
+}
+
+/// @brief Schedule an event. The queue is sized for every actor having one
+/// pending event, which is all the simulation ever needs.
+static void schedule( event_queue_t *queue, uint64_t time_ns, int actor_id ) {
+    size_t idx = queue->size++;
+    queue->events[ idx ].time_ns = time_ns;
+    queue->events[ idx ].sequence = queue->next_sequence++;
+    queue->events[ idx ].actor_id = actor_id;
+
+    while ( idx > 0 ) {
+        size_t parent = ( idx - 1 ) / 2;
+        if ( !event_before( &queue->events[ idx ],
+                            &queue->events[ parent ] ) ) {
+            break;
+        }
+        swap_events( &queue->events[ idx ], &queue->events[ parent ] );
+        idx = parent;
+    }
+}
+
+static virtual_event_t pop_event( event_queue_t *queue ) {
+    virtual_event_t event = queue->events[ 0 ];
+    queue->events[ 0 ] = queue->events[ --queue->size ];
+    sift_down( queue, 0 );
+    return event;
+}
+
+static int init_virtual_resort( virtual_resort_t *resort, arguments_t *args,
+                                journal_t *journal,
+                                resort_metrics_t *metrics ) {
+    resort->journal = journal;
+    resort->metrics = metrics;
+    resort->now_ns = 0;
+    resort->finished_at_ns = 0;
+    resort->skiers_amount = args->skiers_amount;
+    resort->skiers_at_resort = 0;
+    resort->max_walk_to_stop_time = args->max_walk_to_stop_time;
+    resort->stops_amount = args->stops_amount;
+    resort->route = args->route;
+    resort->bus_capacity = args->bus_capacity;
+    resort->buses_amount = args->buses_amount;
+    resort->skip_empty_stops = args->skip_empty_stops;
+
+    // Every skibus and skier has at most one pending event
+    size_t actors_amount =
+        (size_t)args->skiers_amount + (size_t)args->buses_amount;
+    resort->queue.size = 0;
+    resort->queue.next_sequence = 0;
+    resort->queue.events = malloc( sizeof( virtual_event_t ) * actors_amount );
+    resort->skier_stops = malloc( sizeof( int ) * actors_amount );
+    resort->next_waiting = malloc( sizeof( int ) * actors_amount );
+    resort->first_waiting = calloc( (size_t)args->stops_amount + 1,
+                                    sizeof( int ) );
+    resort->last_waiting = calloc( (size_t)args->stops_amount + 1,
+                                   sizeof( int ) );
+    resort->skiers_en_route = calloc( (size_t)args->stops_amount + 1,
+                                      sizeof( int ) );
+    resort->since_ns = malloc( sizeof( uint64_t ) * actors_amount );
+    uint64_t *bitmap_words = calloc( stop_bitmap_words( args->stops_amount ),
+                                     sizeof( uint64_t ) );
+    init_stop_bitmap( &resort->stops_with_demand, bitmap_words,
+                      args->stops_amount );
+    resort->buses = malloc( sizeof( virtual_bus_t ) * args->buses_amount );
+    resort->passengers = malloc( sizeof( int ) * (size_t)args->bus_capacity *
+                                 (size_t)args->buses_amount );
+    if ( resort->queue.events == NULL || resort->skier_stops == NULL ||
+         resort->next_waiting == NULL || resort->first_waiting == NULL ||
+         resort->last_waiting == NULL || resort->since_ns == NULL ||
+         resort->skiers_en_route == NULL || bitmap_words == NULL ||
+         resort->buses == NULL ||
+         resort->passengers == NULL ) {
+        return -1;
+    }
+
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        virtual_bus_t *bus = &resort->buses[ i ];
+        bus->journal_id = args->label_buses ? i + 1 : 0;
+        init_rand_stream( &bus->random, RAND_STREAM_SKIBUS( i ) );
+        bus->passengers = resort->passengers + i * resort->bus_capacity;
+        bus->passengers_amount = 0;
+        bus->stop_idx = 0;
+        bus->segment_idx = 0;
+        bus->parked = false;
+        bus->finished = false;
+    }
+    return 0;
+}
+
+static void destroy_virtual_resort( virtual_resort_t *resort ) {
+    free( resort->queue.events );
+    free( resort->skier_stops );
+    free( resort->next_waiting );
+    free( resort->first_waiting );
+    free( resort->last_waiting );
+    free( resort->since_ns );
+    free( resort->skiers_en_route );
+    free( resort->stops_with_demand.words );
+    free( resort->buses );
+    free( resort->passengers );
+}
+
+/// @brief How long the ride from the bus's last stop to the next one takes.
+static uint64_t ride_time_ns( virtual_resort_t *resort, virtual_bus_t *bus ) {
+    return (uint64_t)route_ride_time( resort->route, bus->segment_idx,
+                                      bus->stop_idx, &bus->random ) *
+           NS_PER_US;
+}
+
+/// @brief Stop the skibus drives to from `stop_idx` on, as `next_stop()` of
+/// the other modes does.
+/// @return `stops_amount` if it drives to the final stop.
+static int next_stop( virtual_resort_t *resort, virtual_bus_t *bus,
+                      int stop_idx ) {
+    if ( !resort->skip_empty_stops ) {
+        return stop_idx;
+    }
+    if ( bus->passengers_amount == resort->bus_capacity ) {
+        return resort->stops_amount;
+    }
+    return stop_bitmap_next( &resort->stops_with_demand, stop_idx );
+}
+
+static void skip_stops( virtual_resort_t *resort, int from_idx, int to_idx ) {
+    for ( int i = from_idx; i < to_idx; i++ ) {
+        metrics_add_stop_skip( resort->metrics, i );
+    }
+}
+
+static void finish_bus( virtual_resort_t *resort, virtual_bus_t *bus ) {
+    journal_bus( resort->journal, bus->journal_id, JOURNAL_FINISH );
+    bus->finished = true;
+    resort->finished_at_ns = resort->now_ns;
+}
+
+/// @brief Skibus starts a loop of the route. If it skips empty stops and
+/// there are none left to pick up from, it parks until everyone is at the
+/// resort instead.
+static void start_loop( virtual_resort_t *resort, int bus_idx ) {
+    virtual_bus_t *bus = &resort->buses[ bus_idx ];
+    bus->stop_idx = next_stop( resort, bus, 0 );
+    bus->segment_idx = 0;
+    if ( bus->stop_idx == resort->stops_amount ) {
+        if ( resort->skiers_at_resort == resort->skiers_amount ) {
+            finish_bus( resort, bus );
+        } else {
+            bus->parked = true;
+        }
+        return;
+    }
+    skip_stops( resort, 0, bus->stop_idx );
+    schedule( &resort->queue, resort->now_ns + ride_time_ns( resort, bus ),
+              -bus_idx );
+}
+
+/// @brief Everyone starts at time 0 and skiers start walking.
+static void start_virtual_resort( virtual_resort_t *resort ) {
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        journal_bus( resort->journal, resort->buses[ i ].journal_id,
+                     JOURNAL_STARTED );
+    }
+
+    for ( int skier_id = 1; skier_id <= resort->skiers_amount; skier_id++ ) {
+        // Same draws as `plan_skier()`, so a seed gives the same skiers as in
+        // the other modes
+        rand_stream_t random;
+        init_rand_stream( &random, (uint64_t)skier_id );
+        resort->skier_stops[ skier_id ] =
+            rand_number( &random, resort->stops_amount );
+        resort->skiers_en_route[ resort->skier_stops[ skier_id ] ]++;
+        stop_bitmap_add( &resort->stops_with_demand,
+                         resort->skier_stops[ skier_id ] - 1 );
+        int time_to_stop =
+            rand_number( &random, resort->max_walk_to_stop_time );
+
+        journal_skier( resort->journal, skier_id, JOURNAL_STARTED );
+        resort->since_ns[ skier_id ] = 0;
+        schedule( &resort->queue, (uint64_t)time_to_stop * NS_PER_US,
+                  skier_id );
+    }
+
+    for ( int i = 0; i < resort->buses_amount; i++ ) {
+        start_loop( resort, i );
+    }
+}
+
+static void skier_arrives( virtual_resort_t *resort, int skier_id ) {
+    int bus_stop_id = resort->skier_stops[ skier_id ];
+    journal_skier_arrived_to_stop( resort->journal, skier_id, bus_stop_id );
+    metrics_add_walk( resort->metrics,
+                      resort->now_ns - resort->since_ns[ skier_id ] );
+    resort->since_ns[ skier_id ] = resort->now_ns;
+    resort->skiers_en_route[ bus_stop_id ]--;
+
+    resort->next_waiting[ skier_id ] = 0;
+    if ( resort->last_waiting[ bus_stop_id ] == 0 ) {
+        resort->first_waiting[ bus_stop_id ] = skier_id;
+    } else {
+        resort->next_waiting[ resort->last_waiting[ bus_stop_id ] ] = skier_id;
+    }
+    resort->last_waiting[ bus_stop_id ] = skier_id;
+}
+
+/// @brief Boarding takes no virtual time, so skibuses never board at the same
+/// stop at once.
+static void board_passengers( virtual_resort_t *resort, virtual_bus_t *bus,
+                              int bus_stop_id ) {
+    while ( bus->passengers_amount < resort->bus_capacity &&
+            resort->first_waiting[ bus_stop_id ] != 0 ) {
+        int skier_id = resort->first_waiting[ bus_stop_id ];
+        resort->first_waiting[ bus_stop_id ] = resort->next_waiting[ skier_id ];
+        if ( resort->first_waiting[ bus_stop_id ] == 0 ) {
+            resort->last_waiting[ bus_stop_id ] = 0;
+        }
+
+        journal_skier_boarding( resort->journal, skier_id );
+        metrics_add_boarding( resort->metrics, bus_stop_id - 1,
+                              resort->now_ns - resort->since_ns[ skier_id ] );
+        resort->since_ns[ skier_id ] = resort->now_ns;
+        bus->passengers[ bus->passengers_amount++ ] = skier_id;
+    }
+    if ( resort->first_waiting[ bus_stop_id ] == 0 &&
+         resort->skiers_en_route[ bus_stop_id ] == 0 ) {
+        stop_bitmap_remove( &resort->stops_with_demand, bus_stop_id - 1 );
+    }
+}
+
+static void let_passengers_out( virtual_resort_t *resort,
+                                virtual_bus_t *bus ) {
+    for ( int i = 0; i < bus->passengers_amount; i++ ) {
+        int skier_id = bus->passengers[ i ];
+        metrics_add_ride( resort->metrics,
+                          resort->now_ns - resort->since_ns[ skier_id ] );
+        journal_skier_going_to_ski( resort->journal, skier_id );
+    }
+    resort->skiers_at_resort += bus->passengers_amount;
+    bus->passengers_amount = 0;
+}
+
+/// @brief Skibus arrives to a stop, boards skiers and leaves. After the last
+/// stop it drives to the final stop right away, as `drive_skibus()` does.
+static void bus_arrives( virtual_resort_t *resort, int bus_idx ) {
+    virtual_bus_t *bus = &resort->buses[ bus_idx ];
+    int bus_stop_id = bus->stop_idx + 1;
+    journal_bus_arrived( resort->journal, bus->journal_id, bus_stop_id );
+    board_passengers( resort, bus, bus_stop_id );
+    journal_bus_leaving( resort->journal, bus->journal_id, bus_stop_id );
+    metrics_add_stop_visit( resort->metrics, bus->stop_idx,
+                            bus->passengers_amount );
+
+    int next_stop_idx = next_stop( resort, bus, bus->stop_idx + 1 );
+    skip_stops( resort, bus->stop_idx + 1, next_stop_idx );
+    bus->segment_idx = bus->stop_idx + 1;
+    bus->stop_idx = next_stop_idx;
+    if ( bus->stop_idx < resort->stops_amount ) {
+        schedule( &resort->queue, resort->now_ns + ride_time_ns( resort, bus ),
+                  -bus_idx );
+        return;
+    }
+
+    journal_bus( resort->journal, bus->journal_id, JOURNAL_ARRIVED_TO_FINAL );
+    metrics_add_trip( resort->metrics, bus->passengers_amount );
+    let_passengers_out( resort, bus );
+    journal_bus( resort->journal, bus->journal_id, JOURNAL_LEAVING_FINAL );
+    loginfo( "skiers at the resort: %i", resort->skiers_at_resort );
+
+    if ( resort->skiers_at_resort == resort->skiers_amount ) {
+        finish_bus( resort, bus );
+        // Parked skibuses were waiting for this
+        for ( int i = 0; i < resort->buses_amount; i++ ) {
+            if ( resort->buses[ i ].parked ) {
+                resort->buses[ i ].parked = false;
+                finish_bus( resort, &resort->buses[ i ] );
+            }
+        }
+        return;
+    }
+    start_loop( resort, bus_idx );
+}
+
+static void run_events( virtual_resort_t *resort ) {
+    while ( resort->queue.size > 0 ) {
+        virtual_event_t event = pop_event( &resort->queue );
+        resort->now_ns = event.time_ns;
+
+        if ( event.actor_id <= 0 ) {
+            bus_arrives( resort, -event.actor_id );
+        } else {
+            skier_arrives( resort, event.actor_id );
+        }
+    }
+}
+
+int run_virtual_time_simulation( arguments_t *args ) {
+    // The journal is written by this thread only, it does not have to be
+    // shared nor locked
+    shared_arena_t arena;
+    size_t arena_size = journal_shared_size( JOURNAL_BUFFERED ) +
+                        metrics_shared_size( args->stops_amount );
+    if ( init_shared_arena( &arena, arena_size, VIRTUAL_TIME_ARENA_NAME, false,
+                            false ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        return -1;
+    }
+    journal_t journal;
+    if ( init_journal( &journal, &arena, args->output, JOURNAL_BUFFERED,
+                       args->journal_format ) == -1 ) {
+        (void)fprintf( stderr, "failed to open the journal\n" );
+        destroy_shared_arena( &arena );
+        return -1;
+    }
+
+    resort_metrics_t metrics;
+    if ( init_metrics( &metrics, &arena, args->stops_amount,
+                       args->bus_capacity ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        destroy_journal( &journal );
+        destroy_shared_arena( &arena );
+        return -1;
+    }
+
+    virtual_resort_t resort;
+    if ( init_virtual_resort( &resort, args, &journal, &metrics ) == -1 ) {
+        (void)fprintf( stderr, "failed to allocate enough memory\n" );
+        destroy_virtual_resort( &resort );
+        destroy_journal( &journal );
+        destroy_shared_arena( &arena );
+        return -1;
+    }
+    journal.clock_ns = &resort.now_ns;
+
+    struct timespec started_at;
+    clock_gettime( CLOCK_MONOTONIC, &started_at );
+
+    start_virtual_resort( &resort );
+    run_events( &resort );
+
+    int result = 0;
+    for ( int i = 0; i < resort.buses_amount; i++ ) {
+        if ( !resort.buses[ i ].finished ) {
+            (void)fprintf( stderr, "the skibuses did not take every skier to "
+                                   "the resort\n" );
+            result = -1;
+            break;
+        }
+    }
+
+    // Virtual time says nothing about performance, report the real time
+    if ( result == 0 && args->report_timing ) {
+        struct timespec finished_at;
+        clock_gettime( CLOCK_MONOTONIC, &finished_at );
+        print_timing_report(
+            ( finished_at.tv_sec - started_at.tv_sec ) * 1000000000LL +
+                ( finished_at.tv_nsec - started_at.tv_nsec ),
+            &journal );
+    }
+    if ( result == 0 && args->report != NULL ) {
+        fill_run_report( args->report, &metrics,
+                         (long long)resort.finished_at_ns );
+    }
+    // Durations are in virtual time
+    if ( result == 0 && args->print_metrics ) {
+        print_metrics( stderr, &metrics );
+    }
+
+    destroy_virtual_resort( &resort );
+    destroy_journal( &journal );
+    destroy_shared_arena( &arena );
+    return result;
+}